@@ -0,0 +1,376 @@
+// Benchmark of CDFTree against baseline structures.
+//
+//   benchmark [samples] [queries] [filter]
+//
+// For every key type and workload distribution samples are inserted one by
+// one, then queries of the same distribution are run. Each line reports
+// throughput, latency percentiles and memory per distinct key. Latencies are
+// measured over blocks of consecutive operations to keep the clock out of
+// the numbers. Only lines containing filter (if given) are run.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cdf_tree_main.h"
+
+
+/////////////////////////// MEMORY /////////////////////////////
+// baselines allocate through CountingAllocator, CDFTree reports its pages
+
+std::size_t allocated_bytes = 0;
+
+template<class T>
+struct CountingAllocator {
+    using value_type = T;
+    CountingAllocator() = default;
+    template<class U>
+    CountingAllocator(const CountingAllocator<U>&) {}
+
+    T* allocate(std::size_t n) {
+        allocated_bytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* p, std::size_t n) {
+        allocated_bytes -= n * sizeof(T);
+        std::allocator<T>().deallocate(p, n);
+    }
+    template<class U>
+    bool operator==(const CountingAllocator<U>&) const { return true; }
+    template<class U>
+    bool operator!=(const CountingAllocator<U>&) const { return false; }
+};
+
+
+/////////////////////////// WORKLOADS //////////////////////////
+
+enum class Distribution { Uniform, Sorted, Zipf, Duplicates };
+
+const char* name(Distribution distribution) {
+    switch (distribution) {
+        case Distribution::Uniform:    return "uniform";
+        case Distribution::Sorted:     return "sorted";
+        case Distribution::Zipf:       return "zipf";
+        case Distribution::Duplicates: return "duplicates";
+    }
+    return "";
+}
+
+template<class T> const char* type_name();
+template<> const char* type_name<int>()    { return "int"; }
+template<> const char* type_name<float>()  { return "float"; }
+template<> const char* type_name<double>() { return "double"; }
+
+template<class T>
+class Workload {
+    // values are spread over [-2^30, 2^30) and converted to T
+public:
+    Workload(Distribution distribution, std::size_t size, unsigned seed)
+        : distribution(distribution), size(size), rng(seed), position(0)
+    {
+        if (distribution == Distribution::Zipf) {
+            // cumulative weights of ranks with exponent 1.1, rank r has weight 1/r^1.1
+            zipf.resize(size);
+            double sum = 0;
+            for (std::size_t r = 0; r < size; ++r)
+                zipf[r] = sum += std::pow(r + 1., -1.1);
+        }
+    }
+
+    T next() {
+        constexpr double Range = 1u << 30;
+        switch (distribution) {
+            case Distribution::Uniform:
+                return convert(std::uniform_real_distribution<double>(-Range, Range)(rng));
+            case Distribution::Sorted:
+                return convert(-Range + 2 * Range * (position++ % size) / size);
+            case Distribution::Zipf: {
+                double u = std::uniform_real_distribution<double>(0, zipf.back())(rng);
+                std::uint64_t rank = std::lower_bound(zipf.begin(), zipf.end(), u) - zipf.begin();
+                // popular elements are scattered over the range
+                std::uint64_t hash = (rank + 1) * 0x9E3779B97F4A7C15ull;
+                return convert(-Range + 2 * Range * static_cast<double>(hash >> 11) / (1ull << 53));
+            }
+            case Distribution::Duplicates:
+                return convert(-Range + 2 * Range * (rng() % 1000) / 1000);
+        }
+        return T();
+    }
+
+    std::vector<T> generate(std::size_t count) {
+        std::vector<T> values(count);
+        for (T& value : values)
+            value = next();
+        return values;
+    }
+
+private:
+    static T convert(double value) { return static_cast<T>(value); }
+
+    Distribution        distribution;
+    std::size_t         size;
+    std::mt19937_64     rng;
+    std::size_t         position;
+    std::vector<double> zipf;
+};
+
+
+/////////////////////////// STRUCTURES /////////////////////////
+// all of them provide insert, count, rank (samples <= e), select (element
+// of given rank), bytes and distinct; prepare gets all samples beforehand
+
+template<class T, unsigned PageSize>
+class TreeStructure {
+    using Traits = KeyTraits<T>;
+    using Key = typename Traits::Stored;
+
+public:
+    static std::string name() { return "cdftree/" + std::to_string(PageSize); }
+    static constexpr bool bulk = false;
+
+    TreeStructure() : root(RootNodeCluster<Key, PageSize>::factory()) {}
+    void prepare(const std::vector<T>&) {}
+    void insert(T e) { root->insert_sample(Traits::encode(e)); }
+    unsigned count(T e) const { return root->search_PDF(Traits::encode(e)); }
+    unsigned long long rank(T e) const { return root->search_CDF(Traits::encode(e)); }
+    T select(unsigned long long r) const { return Traits::decode(root->inverse_search_CDF(r)); }
+    std::size_t bytes() const { return root->used_bytes(); }
+    std::size_t distinct() const {
+        std::size_t size = 0;
+        root->for_each([&](Key, unsigned) { ++size; });
+        return size;
+    }
+
+private:
+    std::shared_ptr<RootNodeCluster<Key, PageSize>> root;
+};
+
+template<class T>
+class MapFenwickStructure {
+    // std::map gives position of element in the universe of all samples
+    // (known beforehand), Fenwick tree over positions gives ranks
+public:
+    static std::string name() { return "map+fenwick"; }
+    static constexpr bool bulk = false;
+
+    void prepare(const std::vector<T>& samples) {
+        elements.assign(samples.begin(), samples.end());
+        std::sort(elements.begin(), elements.end());
+        elements.erase(std::unique(elements.begin(), elements.end()), elements.end());
+        elements.shrink_to_fit();
+        for (std::size_t i = 0; i < elements.size(); ++i)
+            positions.emplace_hint(positions.end(), elements[i], i);
+        counts.assign(elements.size(), 0);
+    }
+    void insert(T e) {
+        utils::fenwick_add(counts.data(), counts.size(), positions.find(e)->second, 1ull);
+    }
+    unsigned count(T e) const {
+        auto found = positions.find(e);
+        return found == positions.end() ? 0 : utils::fenwick_value(counts.data(), found->second);
+    }
+    unsigned long long rank(T e) const {
+        auto greater = positions.upper_bound(e);
+        std::size_t position = greater == positions.end() ? elements.size() : greater->second;
+        return utils::fenwick_prefix(counts.data(), position);
+    }
+    T select(unsigned long long r) const {
+        unsigned long long remaining = r;
+        return elements[utils::fenwick_select(counts.data(), counts.size(), remaining)];
+    }
+    std::size_t bytes() const { return allocated_bytes; }
+    std::size_t distinct() const {
+        std::size_t size = 0;
+        for (std::size_t i = 0; i < elements.size(); ++i)
+            size += utils::fenwick_value(counts.data(), i) > 0;
+        return size;
+    }
+
+private:
+    std::map<T, std::size_t, std::less<T>, CountingAllocator<std::pair<const T, std::size_t>>> positions;
+    std::vector<T, CountingAllocator<T>> elements;
+    std::vector<unsigned long long, CountingAllocator<unsigned long long>> counts;
+};
+
+template<class T>
+class SortedVectorStructure {
+    // elements with cumulative counts, built at once from all samples
+public:
+    static std::string name() { return "sorted-vector"; }
+    static constexpr bool bulk = true;
+
+    void prepare(const std::vector<T>&) {}
+    void build(std::vector<T> samples) {
+        std::sort(samples.begin(), samples.end());
+        for (std::size_t i = 0; i < samples.size(); ++i) {
+            if (i == 0 or samples[i-1] < samples[i]) {
+                elements.push_back(samples[i]);
+                cumulative.push_back(cumulative.empty() ? 0 : cumulative.back());
+            }
+            cumulative.back() += 1;
+        }
+        elements.shrink_to_fit();
+        cumulative.shrink_to_fit();
+    }
+    unsigned count(T e) const {
+        auto found = std::lower_bound(elements.begin(), elements.end(), e);
+        if (found == elements.end() or e < *found)
+            return 0;
+        std::size_t i = found - elements.begin();
+        return cumulative[i] - (i == 0 ? 0 : cumulative[i-1]);
+    }
+    unsigned long long rank(T e) const {
+        std::size_t i = std::upper_bound(elements.begin(), elements.end(), e) - elements.begin();
+        return i == 0 ? 0 : cumulative[i-1];
+    }
+    T select(unsigned long long r) const {
+        return elements[std::lower_bound(cumulative.begin(), cumulative.end(), r) - cumulative.begin()];
+    }
+    std::size_t bytes() const { return allocated_bytes; }
+    std::size_t distinct() const { return elements.size(); }
+
+private:
+    std::vector<T, CountingAllocator<T>> elements;
+    std::vector<unsigned long long, CountingAllocator<unsigned long long>> cumulative;
+};
+
+
+/////////////////////////// MEASUREMENT ////////////////////////
+
+struct Options {
+    std::size_t samples = 1000000;
+    std::size_t queries = 1000000;
+    std::string filter;
+};
+
+struct Result {
+    double throughput = 0;          // operations per second
+    double p50 = 0, p99 = 0, p999 = 0;
+    bool latencies = false;
+};
+
+// calls operation(i) for i in [0, count)
+template<class Operation>
+Result measure(std::size_t count, Operation operation) {
+    constexpr std::size_t Block = 32;
+    using Clock = std::chrono::steady_clock;
+    std::vector<double> latencies;
+    latencies.reserve(count / Block + 1);
+
+    auto start = Clock::now();
+    for (std::size_t first = 0; first < count; first += Block) {
+        std::size_t last = std::min(count, first + Block);
+        auto block_start = Clock::now();
+        for (std::size_t i = first; i < last; ++i)
+            operation(i);
+        std::chrono::duration<double, std::nano> block = Clock::now() - block_start;
+        latencies.push_back(block.count() / (last - first));
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    auto percentile = [&](double p) {
+        auto nth = latencies.begin() + static_cast<std::size_t>(p * (latencies.size() - 1));
+        std::nth_element(latencies.begin(), nth, latencies.end());
+        return *nth;
+    };
+    Result result;
+    result.throughput = count / seconds;
+    if (not latencies.empty()) {
+        result.p50 = percentile(0.5);
+        result.p99 = percentile(0.99);
+        result.p999 = percentile(0.999);
+        result.latencies = true;
+    }
+    return result;
+}
+
+void print(const std::string& label, const Result& result, double bytes_per_key) {
+    std::cout << std::left << std::setw(48) << label << std::right << std::fixed
+              << std::setprecision(2) << std::setw(10) << result.throughput / 1e6 << std::setprecision(0);
+    if (result.latencies)
+        std::cout << std::setw(10) << result.p50 << std::setw(10) << result.p99 << std::setw(10) << result.p999;
+    else
+        std::cout << std::setw(10) << "-" << std::setw(10) << "-" << std::setw(10) << "-";
+    std::cout << std::setprecision(1) << std::setw(12) << bytes_per_key << std::endl;
+}
+
+unsigned long long checksum = 0;
+
+template<class Structure, class T>
+void run(Distribution distribution, const Options& options) {
+    std::string prefix = Structure::name() + " " + type_name<T>() + " " + name(distribution) + " ";
+    if (not options.filter.empty() and prefix.find(options.filter) == std::string::npos)
+        return;
+
+    Workload<T> workload(distribution, options.samples, 1);
+    std::vector<T> samples = workload.generate(options.samples);
+    std::vector<T> queries = workload.generate(options.queries);
+    std::mt19937_64 rng(2);
+    std::vector<unsigned long long> ranks(options.queries);
+    for (auto& r : ranks)
+        r = 1 + rng() % options.samples;
+
+    std::size_t base_bytes = allocated_bytes;
+    Structure structure;
+    structure.prepare(samples);
+    Result inserts;
+    if constexpr (Structure::bulk) {
+        // built at once, throughput is samples per second of the whole build
+        auto start = std::chrono::steady_clock::now();
+        structure.build(samples);
+        inserts.throughput = samples.size() / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } else {
+        inserts = measure(samples.size(), [&](std::size_t i) { structure.insert(samples[i]); });
+    }
+    double bytes_per_key = static_cast<double>(structure.bytes() - base_bytes) / structure.distinct();
+    print(prefix + (Structure::bulk ? "build" : "insert"), inserts, bytes_per_key);
+
+    print(prefix + "search_PDF", measure(queries.size(),
+            [&](std::size_t i) { checksum += structure.count(queries[i]); }), bytes_per_key);
+    print(prefix + "search_CDF", measure(queries.size(),
+            [&](std::size_t i) { checksum += structure.rank(queries[i]); }), bytes_per_key);
+    print(prefix + "inverse_search_CDF", measure(ranks.size(),
+            [&](std::size_t i) { checksum += static_cast<unsigned long long>(structure.select(ranks[i])); }), bytes_per_key);
+}
+
+template<class T>
+void run_type(const Options& options) {
+    for (Distribution distribution : {Distribution::Uniform, Distribution::Sorted,
+                                      Distribution::Zipf, Distribution::Duplicates}) {
+        run<TreeStructure<T, 4096>, T>(distribution, options);
+        run<TreeStructure<T, 16384>, T>(distribution, options);
+        run<MapFenwickStructure<T>, T>(distribution, options);
+        run<SortedVectorStructure<T>, T>(distribution, options);
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (argc > 1)
+        options.samples = std::strtoull(argv[1], nullptr, 10);
+    if (argc > 2)
+        options.queries = std::strtoull(argv[2], nullptr, 10);
+    if (argc > 3)
+        options.filter = argv[3];
+    if (options.samples == 0) {
+        std::cerr << "usage: " << argv[0] << " [samples] [queries] [filter]" << std::endl;
+        return 1;
+    }
+
+    std::cout << std::left << std::setw(48) << "structure type distribution operation" << std::right
+              << std::setw(10) << "Mops/s" << std::setw(10) << "p50 ns" << std::setw(10) << "p99 ns"
+              << std::setw(10) << "p99.9 ns" << std::setw(12) << "bytes/key" << std::endl;
+    run_type<int>(options);
+    run_type<float>(options);
+    run_type<double>(options);
+    std::cout << "checksum: " << checksum << std::endl;
+}
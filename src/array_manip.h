@@ -5,8 +5,15 @@
 #include <utility>
 #include <array>
 #include <iterator>
+#include <type_traits>
+#include <vector>
+#include <cstddef>
+#include <cstring>
+#include <limits>
 #include <boost/assert.hpp>
 
+#include "simd_search.h"
+
 ///////////////////////// UTILS /////////////////////////////
 namespace utils {
 
@@ -15,6 +22,9 @@ template<class T, class M>
 unsigned lower_or_equal_bound (const T* array, unsigned size, const M& element) {
     // returns index of element which is greater or equal than provided reference
     // output is 0-size (including borders)
+    if constexpr (simd::is_supported<T>::value and std::is_same<T, M>::value)
+        return simd::count_less_equal(array, size, element);
+
     unsigned step, count = size, it = 0;
     while (count > 0) {
         step = count / 2;
@@ -33,6 +43,9 @@ template<class T, class M>
 unsigned lower_bound(const T* array, unsigned size, const M& element) {
     // returns index of element which is greater or equal than provided reference
     // output is 0-size (including borders)
+    if constexpr (simd::is_supported<T>::value and std::is_same<T, M>::value)
+        return simd::count_less(array, size, element);
+
     unsigned step, count = size, it = 0;
     while (count > 0) {
         step = count / 2;
@@ -53,6 +66,13 @@ template<class T, class M>
 int binary_search(const T* array, const unsigned size, const M& element) {
     // returns index of element which is greater or equal than provided reference
     // output is 0-size (including borders)
+    if constexpr (simd::is_supported<T>::value and std::is_same<T, M>::value) {
+        unsigned index = simd::count_less(array, size, element);
+        if (index < size and array[index] == element)
+            return static_cast<int>(index);
+        return -1;
+    }
+
     int low = 0, up = size-1;
 
     while (low <= up) {
@@ -71,48 +91,65 @@ int binary_search(const T* array, const unsigned size, const M& element) {
 }
 
 
-template<class T, long unsigned Size>
-inline void insert_array_safe(std::array<T,Size>& array, int size, int index, T element) {
-    std::move_backward(
-        std::move_iterator<typename std::array<T,Size>::iterator>(array.begin() + index),
-        std::move_iterator<typename std::array<T,Size>::iterator>(array.begin() + size),
-        std::move_iterator<typename std::array<T,Size>::iterator>(array.begin() + size + 1)
-        );
-    array[index] = std::move(element);
+///////////////////////// FENWICK //////////////////////////
+// Prefix sums kept in place of plain array (binary indexed tree),
+// tree[i] holds sum of elements [i & (i+1), i].
+
+template<class T>
+inline void fenwick_build(T* tree, unsigned size) {
+    for (unsigned i = 0; i < size; ++i) {
+        unsigned parent = i | (i + 1);
+        if (parent < size)
+            tree[parent] += tree[i];
+    }
+}
+
+template<class T>
+inline void fenwick_unbuild(T* tree, unsigned size) {
+    // converts tree back into plain array
+    for (unsigned i = size; i-- > 0; ) {
+        unsigned parent = i | (i + 1);
+        if (parent < size)
+            tree[parent] -= tree[i];
+    }
+}
+
+template<class T>
+inline void fenwick_add(T* tree, unsigned size, unsigned index, T value) {
+    for (; index < size; index |= index + 1)
+        tree[index] += value;
+}
+
+template<class T>
+inline T fenwick_prefix(const T* tree, unsigned index) {
+    // sum of elements [0, index)
+    T sum = 0;
+    for (; index > 0; index &= index - 1)
+        sum += tree[index - 1];
+    return sum;
 }
 
-template<class T, long unsigned Size>
-inline void  two_way_array_move(
-        std::array<T,Size>& input, 
-        std::array<T,Size>& smaller, 
-        std::array<T,Size>& bigger, 
-        unsigned pivot_index) 
-{
-    std::move(
-        std::move_iterator<typename std::array<T,Size>::iterator>(input.begin()),
-        std::move_iterator<typename std::array<T,Size>::iterator>(input.begin() + pivot_index + 1),
-        std::move_iterator<typename std::array<T,Size>::iterator>(smaller.begin())
-        );
-    std::move(
-        std::move_iterator<typename std::array<T,Size>::iterator>(input.begin() + pivot_index + 1),
-        std::move_iterator<typename std::array<T,Size>::iterator>(input.end()),
-        std::move_iterator<typename std::array<T,Size>::iterator>(bigger.begin())
-        );
+template<class T>
+inline T fenwick_value(const T* tree, unsigned index) {
+    return fenwick_prefix(tree, index + 1) - fenwick_prefix(tree, index);
 }
 
-template<class T, long unsigned Size>
-inline void  one_way_array_move(
-        std::array<T,Size>& input, 
-        std::array<T,Size>& bigger, 
-        unsigned pivot_index) 
-{
-    std::move(
-        std::move_iterator<typename std::array<T,Size>::iterator>(input.begin() + pivot_index + 1),
-        std::move_iterator<typename std::array<T,Size>::iterator>(input.end()),
-        std::move_iterator<typename std::array<T,Size>::iterator>(bigger.begin())
-        );
+template<class T>
+inline unsigned fenwick_select(const T* tree, unsigned size, T& value) {
+    // returns first index whose prefix sum reaches value,
+    // value is reduced to remainder inside of that element (size if not found)
+    if (size == 0)
+        return 0;
+    unsigned index = 0;
+    for (unsigned step = 1u << (31 - __builtin_clz(size)); step > 0; step >>= 1)
+        if (index + step <= size and tree[index + step - 1] < value) {
+            index += step;
+            value -= tree[index - 1];
+        }
+    return index;
 }
 
+
 template<class T>
 void insert_into_array(T* array, unsigned size, T element, unsigned index) {
     if (size > index) {
@@ -126,6 +163,41 @@ void insert_into_array(T* array, unsigned size, T element, unsigned index) {
     array[index] = element;
 }
 
+template<class T>
+void erase_from_array(T* array, unsigned size, unsigned index) {
+    BOOST_ASSERT(index < size);
+    if (size > index + 1) {
+        std::memmove(
+            reinterpret_cast<void*>(index + array),     // destination 
+            reinterpret_cast<void*>(index + 1 + array), // src
+            sizeof(T)*(size - index - 1)
+            );
+    }
+}
+
+// true if a + b does not fit into unsigned T, other sums are not checked
+template<class T>
+inline bool sum_overflows(T a, T b) {
+    if constexpr (std::is_unsigned<T>::value)
+        return a > std::numeric_limits<T>::max() - b;
+    return false;
+}
+
+template<class T, class C>
+void aggregate_sorted(const T* sorted, std::size_t size, std::vector<T>& keys, std::vector<C>& counts) {
+    // run-length encoding of sorted samples
+    keys.clear();
+    counts.clear();
+    for (std::size_t i = 0; i < size; ) {
+        std::size_t j = i + 1;
+        while (j < size and sorted[j] == sorted[i])
+            ++j;
+        keys.push_back(sorted[i]);
+        counts.push_back(static_cast<C>(j - i));
+        i = j;
+    }
+}
+
 } // end namespace utils
 
 #endif // INCLUDED_ARRAY_MANIPULATION
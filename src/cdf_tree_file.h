@@ -0,0 +1,312 @@
+#if not defined INCLUDED_CDF_TREE_FILE
+#define INCLUDED_CDF_TREE_FILE
+
+// On-disk format of a tree (native byte order, checked on load):
+//
+//   CDFTreeFileHeader                      64 bytes
+//   CDFTreeFileRecord<Type> x size         {element, cumulative count} in increasing order
+//
+// Records are written in a single pass over the leaves and can be searched
+// directly in a read-only mapping (MappedCDFTree), nothing is deserialized.
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cdf_tree_main.h"
+
+
+template<class Type>
+struct CDFTreeFileRecord {
+    Type            element;
+    std::uint64_t   cumulative;     // counts of all elements up to this one
+};
+
+struct CDFTreeFileHeader {
+    static constexpr char          Magic[8] = {'C', 'D', 'F', 'T', 'R', 'E', 'E', '\0'};
+    static constexpr std::uint32_t Version = 1;
+    static constexpr std::uint32_t ByteOrder = 0x01020304;
+    enum KeyKind : std::uint32_t { Signed = 0, Unsigned = 1, Floating = 2, Other = 3 };
+
+    char            magic[8];
+    std::uint32_t   version;
+    std::uint32_t   byte_order;
+    std::uint32_t   key_size;
+    std::uint32_t   key_kind;
+    std::uint64_t   size;           // number of records
+    std::uint64_t   total;          // sum of all counts
+    char            reserved[24];
+
+    template<class Type>
+    static CDFTreeFileHeader describe(std::uint64_t size, std::uint64_t total) {
+        CDFTreeFileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, Magic, sizeof(Magic));
+        header.version = Version;
+        header.byte_order = ByteOrder;
+        header.key_size = sizeof(Type);
+        header.key_kind = std::is_floating_point<Type>::value ? Floating :
+                          std::is_integral<Type>::value ? (std::is_signed<Type>::value ? Signed : Unsigned) : Other;
+        header.size = size;
+        header.total = total;
+        return header;
+    }
+
+    // throws if the file was not written for Type on this kind of machine
+    template<class Type>
+    void validate(std::size_t file_size) const {
+        CDFTreeFileHeader expected = describe<Type>(size, total);
+        if (file_size < sizeof(CDFTreeFileHeader) or std::memcmp(magic, Magic, sizeof(Magic)) != 0)
+            throw std::runtime_error("CDFTree file: not a CDFTree file");
+        if (version != Version)
+            throw std::runtime_error("CDFTree file: unsupported version");
+        if (byte_order != ByteOrder)
+            throw std::runtime_error("CDFTree file: written with different byte order");
+        if (key_size != expected.key_size or key_kind != expected.key_kind)
+            throw std::runtime_error("CDFTree file: element type does not match");
+        if ((file_size - sizeof(CDFTreeFileHeader)) / sizeof(CDFTreeFileRecord<Type>) < size)
+            throw std::runtime_error("CDFTree file: file is truncated");
+    }
+};
+static_assert(sizeof(CDFTreeFileHeader) == 64, "CDFTreeFileHeader has to keep its layout");
+
+
+template<class Type>
+void CDFTree<Type>::save(const std::string& path) const {
+    static_assert(std::is_trivially_copyable<Type>::value, "Only trivially copyable elements can be saved");
+    using Record = CDFTreeFileRecord<Type>;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (not file)
+        throw std::runtime_error("CDFTree file: cannot open " + path + " for writing");
+
+    // size is known at the end, header is rewritten then
+    CDFTreeFileHeader header = CDFTreeFileHeader::describe<Type>(0, counter);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    constexpr std::size_t BufferSize = 4096;
+    std::vector<Record> buffer;
+    buffer.reserve(BufferSize);
+    std::uint64_t cumulative = 0;
+    auto flush = [&]() {
+        file.write(reinterpret_cast<const char*>(buffer.data()), sizeof(Record) * buffer.size());
+        header.size += buffer.size();
+        buffer.clear();
+    };
+    for_each([&](Type element, unsigned count) {
+        Record record;
+        std::memset(&record, 0, sizeof(record));
+        cumulative += count;
+        record.element = element;
+        record.cumulative = cumulative;
+        buffer.push_back(record);
+        if (buffer.size() == BufferSize)
+            flush();
+    });
+    flush();
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+    if (not file)
+        throw std::runtime_error("CDFTree file: writing of " + path + " failed");
+}
+
+template<class Type>
+CDFTree<Type> CDFTree<Type>::load(const std::string& path) {
+    using Record = CDFTreeFileRecord<Type>;
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (not file)
+        throw std::runtime_error("CDFTree file: cannot open " + path);
+    std::size_t file_size = file.tellg();
+    file.seekg(0);
+
+    CDFTreeFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    header.validate<Type>(file_size);
+
+    std::vector<Type> keys(header.size);
+    std::vector<unsigned> counts(header.size);
+    std::uint64_t previous = 0;
+    for (std::size_t i = 0; i < header.size; ++i) {
+        Record record;
+        file.read(reinterpret_cast<char*>(&record), sizeof(record));
+        // every stored element has a count, which fits unsigned
+        if (record.cumulative <= previous or record.cumulative - previous > std::numeric_limits<unsigned>::max())
+            throw std::runtime_error("CDFTree file: corrupted content of " + path);
+        keys[i] = record.element;
+        counts[i] = static_cast<unsigned>(record.cumulative - previous);
+        previous = record.cumulative;
+    }
+    if (not file or previous != header.total)
+        throw std::runtime_error("CDFTree file: corrupted content of " + path);
+    return from_sorted(keys.data(), counts.data(), keys.size());
+}
+
+
+template<class Type>
+class MappedCDFTree {
+    // read-only view of a saved tree, file is mapped and searched in place,
+    // elements are compared encoded as in CDFTree
+    using Record = CDFTreeFileRecord<Type>;
+    using Traits = KeyTraits<Type>;
+    using Key = typename Traits::Stored;
+
+public:
+    explicit MappedCDFTree(const std::string& path);
+    ~MappedCDFTree();
+    MappedCDFTree(const MappedCDFTree&) = delete;
+    MappedCDFTree& operator=(const MappedCDFTree&) = delete;
+
+    // element -> probability
+    double search_PDF(Type) const;
+    unsigned search_count(Type) const;
+    // element -> cummulative probability
+    double search_CDF(Type e) const;
+    // cummulative proabibility -> element
+    Type inverse_search_CDF(double) const;
+
+    Type minimal_element() const;
+    Type maximal_element() const;
+
+    // number of samples
+    unsigned long long size() const { return total; }
+
+    // Opening checks the header and the last record only. This reads every record
+    // and throws unless elements and cumulative counts strictly increase, which
+    // searches rely on; meant for files that may be damaged.
+    void verify() const;
+
+protected:
+    // number of samples lower or equal to e
+    std::uint64_t rank(Type e) const;
+
+    void*           mapping;
+    std::size_t     mapping_size;
+    const Record*   records;
+    std::size_t     count;
+    std::uint64_t   total;
+};
+
+
+template<class Type>
+MappedCDFTree<Type>::MappedCDFTree(const std::string& path) : mapping(MAP_FAILED), mapping_size(0) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("CDFTree file: cannot open " + path);
+    struct stat info;
+    if (::fstat(fd, &info) != 0 or static_cast<std::size_t>(info.st_size) < sizeof(CDFTreeFileHeader)) {
+        ::close(fd);
+        throw std::runtime_error("CDFTree file: not a CDFTree file");
+    }
+    mapping_size = info.st_size;
+    mapping = ::mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("CDFTree file: cannot map " + path);
+
+    try {
+        const CDFTreeFileHeader* header = static_cast<const CDFTreeFileHeader*>(mapping);
+        header->validate<Type>(mapping_size);
+        records = reinterpret_cast<const Record*>(static_cast<const char*>(mapping) + sizeof(CDFTreeFileHeader));
+        count = header->size;
+        total = header->total;
+        // only the last record is read on open, verify() checks all of them
+        if ((count == 0 ? 0 : records[count - 1].cumulative) != total)
+            throw std::runtime_error("CDFTree file: corrupted content of " + path);
+    } catch (...) {
+        ::munmap(mapping, mapping_size);
+        throw;
+    }
+}
+
+template<class Type>
+MappedCDFTree<Type>::~MappedCDFTree() {
+    if (mapping != MAP_FAILED)
+        ::munmap(mapping, mapping_size);
+}
+
+template<class Type>
+void MappedCDFTree<Type>::verify() const {
+    std::uint64_t previous = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        if (records[i].cumulative <= previous or
+                (i > 0 and not (Traits::encode(records[i-1].element) < Traits::encode(records[i].element))))
+            throw std::runtime_error("CDFTree file: corrupted content");
+        previous = records[i].cumulative;
+    }
+}
+
+template<class Type>
+std::uint64_t MappedCDFTree<Type>::rank(Type e) const {
+    const Record* end = records + count;
+    const Record* greater = std::upper_bound(records, end, Traits::encode(e),
+            [](Key key, const Record& r) { return key < Traits::encode(r.element); });
+    return greater == records ? 0 : (greater - 1)->cumulative;
+}
+
+template<class Type>
+unsigned MappedCDFTree<Type>::search_count(Type e) const {
+    const Record* end = records + count;
+    Key key = Traits::encode(e);
+    const Record* found = std::lower_bound(records, end, key,
+            [](const Record& r, Key key) { return Traits::encode(r.element) < key; });
+    if (found == end or key < Traits::encode(found->element))
+        return 0;
+    return found->cumulative - (found == records ? 0 : (found - 1)->cumulative);
+}
+
+template<class Type>
+inline double MappedCDFTree<Type>::search_PDF(Type e) const {
+    return static_cast<double>(search_count(e)) / total;
+}
+
+template<class Type>
+inline double MappedCDFTree<Type>::search_CDF(Type e) const {
+    return static_cast<double>(rank(e)) / total;
+}
+
+template<class Type>
+Type MappedCDFTree<Type>::inverse_search_CDF(double e) const {
+    unsigned long long b = static_cast<unsigned long long>(std::ceil(e*total));
+    if (b <= 0) {
+        throw std::runtime_error("Inversion of CDF=0 is impossible to obtain");
+    }
+    const Record* end = records + count;
+    const Record* found = std::lower_bound(records, end, b,
+            [](const Record& r, unsigned long long b) { return r.cumulative < b; });
+    if (found == end)
+        throw std::runtime_error("Inverse search failed");
+    return found->element;
+}
+
+template<class Type>
+Type MappedCDFTree<Type>::minimal_element() const {
+    if (count == 0)
+        throw std::runtime_error("Mininal Element on empty tree");
+    return records[0].element;
+}
+
+template<class Type>
+Type MappedCDFTree<Type>::maximal_element() const {
+    if (count == 0)
+        throw std::runtime_error("Maximal Element on empty tree");
+    return records[count - 1].element;
+}
+
+#endif // INCLUDED_CDF_TREE_FILE
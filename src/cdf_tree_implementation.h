@@ -22,6 +22,7 @@
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
 RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::RootNodeCluster() {
     size = 0;
+    children[0] = null_node;
 }
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
@@ -29,42 +30,174 @@ InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::Internal
 }
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
-ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::ExternalNodeCluster() {
+ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::ExternalNodeCluster() 
+    : prev(null_node), next(null_node)
+{
     size = 0;
+    width = NarrowestWidth;
+    this->leaf = true;
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::link(ExternalNodeClusterType* leaf) {
+    leaf->prev = thisptr;
+    leaf->next = next;
+    if (next != null_node)
+        arena->template at<ExternalNodeClusterType>(next)->prev = leaf->thisptr;
+    next = leaf->thisptr;
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::unlink() {
+    if (prev != null_node)
+        arena->template at<ExternalNodeClusterType>(prev)->next = next;
+    if (next != null_node)
+        arena->template at<ExternalNodeClusterType>(next)->prev = prev;
+    prev = next = null_node;
 }
 
 
 ///////////////////////////////////////////////////
-//////////////// search_PDF ///////////////////////
+//////////////// leaf counts //////////////////////
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
-FreqType RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::search_PDF(Type e) const {
-    unsigned index = utils::lower_or_equal_bound(data, size, e);
+unsigned ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::width_for(FreqType count) {
+    if constexpr (CompactCounts) {
+        if (count <= max_count(1))
+            return 1;
+        if (count <= max_count(2))
+            return 2;
+    }
+    return sizeof(FreqType);
+}
 
-    if (size == 0) {
-        if (children[0] == nullptr) 
-            return 0;
-        return children[0]->search_PDF(e);
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+FreqType ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::max_count(unsigned width) {
+    if (width >= sizeof(FreqType))
+        return std::numeric_limits<FreqType>::max();
+    return static_cast<FreqType>((1ull << (8 * width)) - 1);
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+template<class Function>
+inline decltype(auto) ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::with_counts(Function&& function) const {
+    const unsigned char* counts = counts_bytes();
+    if constexpr (CompactCounts) {
+        if (width == 1)
+            return function(reinterpret_cast<const std::uint8_t*>(counts));
+        if (width == 2)
+            return function(reinterpret_cast<const std::uint16_t*>(counts));
     }
-    else 
-        return children[index]->search_PDF(e);
+    return function(reinterpret_cast<const FreqType*>(counts));
 }
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
-FreqType InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::search_PDF(Type e) const {
-    BOOST_ASSERT(size > 0);
-    unsigned index = utils::lower_or_equal_bound(data, size, e);
-    return children[index]->search_PDF(e);
+template<class Function>
+inline decltype(auto) ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::with_counts(Function&& function) {
+    unsigned char* counts = counts_bytes();
+    if constexpr (CompactCounts) {
+        if (width == 1)
+            return function(reinterpret_cast<std::uint8_t*>(counts));
+        if (width == 2)
+            return function(reinterpret_cast<std::uint16_t*>(counts));
+    }
+    return function(reinterpret_cast<FreqType*>(counts));
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+inline FreqType ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::frequency(unsigned index) const {
+    return with_counts([index](auto counts) { return static_cast<FreqType>(counts[index]); });
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::assign(const Type* keys, const FreqType* counts, unsigned count) {
+    FreqType largest = count == 0 ? 0 : *std::max_element(counts, counts + count);
+    width = width_for(largest);
+    BOOST_ASSERT(count < capacity());
+    size = count;
+    std::copy(keys, keys + count, data());
+    with_counts([&](auto leaf_counts) { std::copy(counts, counts + count, leaf_counts); });
+    update_block_sums(0);
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::redistribute(const std::vector<Type>& keys, const std::vector<FreqType>& counts) {
+    // leaves get at most capacity-1 elements (full leaf would split), run is spread evenly
+    std::size_t total = keys.size();
+    BOOST_ASSERT(total > 0);
+    std::size_t capacity = capacity_for(width_for(*std::max_element(counts.begin(), counts.end()))) - 1;
+    std::size_t pieces = (total + capacity - 1) / capacity;
+
+    assign(keys.data(), counts.data(), total / pieces);
+
+    // pieces are registered from the greatest one, so each lands right behind this leaf
+    for (std::size_t piece = pieces; piece-- > 1; ) {
+        std::size_t begin = total * piece / pieces, end = total * (piece + 1) / pieces;
+        ExternalNodeClusterType* greater_ptr = ExternalNodeClusterType::factory(arena);
+        greater_ptr->assign(keys.data() + begin, counts.data() + begin, end - begin);
+        link(greater_ptr);
+        arena->counters.leaf_splits += 1;
+        arena->template at<RootNodeClusterType>(parent)->register_split(
+                greater_ptr->thisptr, greater_ptr->data()[0], greater_ptr->rank(greater_ptr->size));
+    }
+}
+
+
+///////////////////////////////////////////////////
+//////////////// descent //////////////////////////
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+const ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>* RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::find_leaf(Type e) const {
+    BOOST_ASSERT(children[0] != null_node);
+    const RootNodeClusterType* cluster = this;
+    while (true) {
+        unsigned index = utils::lower_or_equal_bound(cluster->data, cluster->size, e);
+        const NodeClusterType* child = node(cluster->children[index]);
+        if (child->leaf)
+            return static_cast<const ExternalNodeClusterType*>(child);
+        cluster = static_cast<const RootNodeClusterType*>(child);
+    }
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+const ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>* RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::first_leaf() const {
+    if (children[0] == null_node)
+        return nullptr;
+    const NodeClusterType* child = node(children[0]);
+    while (not child->leaf)
+        child = node(static_cast<const RootNodeClusterType*>(child)->children[0]);
+    return static_cast<const ExternalNodeClusterType*>(child);
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+template<class Visitor>
+auto RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::visit_child(NodeIndex index, Visitor&& visitor) const {
+    const NodeClusterType* child = node(index);
+    if (child->leaf)
+        return visitor(static_cast<const ExternalNodeClusterType*>(child));
+    else
+        return visitor(static_cast<const InternalNodeClusterType*>(child));
+}
+
+
+///////////////////////////////////////////////////
+//////////////// search_PDF ///////////////////////
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+FreqType RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::search_PDF(Type e) const {
+    if (children[0] == null_node) 
+        return 0;
+    return find_leaf(e)->search_PDF(e);
 }
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
 FreqType ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::search_PDF(Type e) const {
     BOOST_ASSERT(size > 0);
-    int index = utils::binary_search(data, size, e);
+    int index = utils::binary_search(data(), size, e);
     if (index == -1)
         return 0;
     else
-        return frequencies[index];
+        return frequency(index);
 }
 
 
@@ -73,90 +206,121 @@ FreqType ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>:
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
 CumFreqType RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::search_CDF(Type e) const {
-    unsigned index = utils::lower_or_equal_bound(data, size, e);
-    if (size == 0) {
-        if (children[0] == nullptr)
-            return 0;
-        return children[0]->search_CDF(e);
-    }
-    else {
-        CumFreqType sum = 0;
-        for (unsigned i = 0; i < index; ++i)
-            sum += cached_sums[i];
-        return sum + children[index]->search_CDF(e);
-    }
-}
-template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
-CumFreqType InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::search_CDF(Type e) const {
-    BOOST_ASSERT(size > 0);
-    unsigned index = utils::lower_or_equal_bound(data, size, e);
+    if (children[0] == null_node)
+        return 0;
 
     CumFreqType sum = 0;
-    for (unsigned i = 0; i < index; ++i)
-        sum += cached_sums[i];
-    return sum + children[index]->search_CDF(e);
+    const RootNodeClusterType* cluster = this;
+    while (true) {
+        unsigned index = utils::lower_or_equal_bound(cluster->data, cluster->size, e);
+        sum += utils::fenwick_prefix(cluster->cached_sums, index);
+        const NodeClusterType* child = node(cluster->children[index]);
+        if (child->leaf)
+            return sum + static_cast<const ExternalNodeClusterType*>(child)->search_CDF(e);
+        cluster = static_cast<const RootNodeClusterType*>(child);
+    }
 }
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
 CumFreqType ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::search_CDF(Type e) const {
     BOOST_ASSERT(size > 0);
-    unsigned index = utils::lower_or_equal_bound(data, size, e);
+    unsigned index = utils::lower_or_equal_bound(data(), size, e);
+    return rank(index);
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+CumFreqType ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::rank(unsigned index) const {
+    // sum of frequencies [0, index)
+    unsigned block = index / BlockSize;
     CumFreqType sum = 0;
-    for (unsigned i = 0; i < index; ++i)
-        sum += frequencies[i];
+    for (unsigned i = 0; i < block; ++i)
+        sum += block_sums[i];
+    with_counts([&](auto counts) {
+        for (unsigned i = block * BlockSize; i < index; ++i)
+            sum += counts[i];
+    });
     return sum;
 }
 
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::shift_block_sums(unsigned index) {
+    // frequency was inserted at index and the rest was shifted by one,
+    // each following block passes its last element to the next block
+    unsigned last = (size - 1) / BlockSize;
+    if ((size - 1) % BlockSize == 0)
+        block_sums[last] = 0;
+
+    unsigned block = index / BlockSize;
+    block_sums[block] += frequency(index);
+    for (; block < last; ++block) {
+        FreqType moved = frequency((block + 1) * BlockSize);
+        block_sums[block] -= moved;
+        block_sums[block + 1] += moved;
+    }
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::update_block_sums(unsigned from_index) {
+    // recomputes sums of all blocks starting at block of from_index
+    with_counts([&](auto counts) {
+        for (unsigned block = from_index / BlockSize; block * BlockSize < size; ++block) {
+            CumFreqType sum = 0;
+            unsigned end = std::min(size, (block + 1) * BlockSize);
+            for (unsigned i = block * BlockSize; i < end; ++i)
+                sum += counts[i];
+            block_sums[block] = sum;
+        }
+    });
+}
+
 ///////////////////////////////////////////////////
 ///////////////// draw_CDF ////////////////////////
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
 Type RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::inverse_search_CDF(CumFreqType sum) const {
-    if (children[0] == nullptr)
+    if (children[0] == null_node)
         throw std::runtime_error("Inverse_search_CDF on empty tree");
 
-    unsigned index = 0;
-    for (; index < size + 1; ++index) 
-        if (sum > cached_sums[index]) 
-            sum -= cached_sums[index];
-        else
-            return children[index]->inverse_search_CDF(sum);
-    throw std::runtime_error("Inverse search failed");
-    return data[size-1];
-}
-template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
-Type InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::inverse_search_CDF(CumFreqType sum) const {
-    BOOST_ASSERT(size > 0);
-    unsigned index = 0;
-    for (; index < size + 1; ++index)
-        if (sum > cached_sums[index])
-            sum -= cached_sums[index];
-        else 
-            return children[index]->inverse_search_CDF(sum);
-    throw std::runtime_error("Inverse search failed");
-    return data[size-1];
+    const RootNodeClusterType* cluster = this;
+    while (true) {
+        unsigned index = utils::fenwick_select(cluster->cached_sums, cluster->size + 1, sum);
+        if (index > cluster->size) {
+            // rounded floating point sums may miss the total by a few ulps
+            if constexpr (not std::is_floating_point<CumFreqType>::value)
+                throw std::runtime_error("Inverse search failed");
+            index = cluster->size;
+        }
+        const NodeClusterType* child = node(cluster->children[index]);
+        if (child->leaf)
+            return static_cast<const ExternalNodeClusterType*>(child)->inverse_search_CDF(sum);
+        cluster = static_cast<const RootNodeClusterType*>(child);
+    }
 }
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
 Type ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::inverse_search_CDF(CumFreqType sum) const {
     BOOST_ASSERT(size > 0);
     unsigned index = 0;
-    for (; index < size; ++index)
-        if (sum <= frequencies[index])
-            return data[index];
-        else
-            sum -= frequencies[index];
-    throw std::runtime_error("Inverse search failed");
-    return data[size-1];
-
-        /*
-        if (sum > frequencies[index])
-            sum -= frequencies[index];
+    for (unsigned block = 0; block < Blocks and index < size; ++block, index += BlockSize)
+        if (sum > block_sums[block])
+            sum -= block_sums[block];
         else
             break;
-        */
-    //BOOST_ASSERT(sum <= frequencies[index]);
-    //return data[index];
+
+    bool found = with_counts([&](auto counts) {
+        for (; index < size; ++index)
+            if (sum <= counts[index])
+                return true;
+            else
+                sum -= counts[index];
+        return false;
+    });
+    if (found)
+        return data()[index];
+    if constexpr (std::is_floating_point<CumFreqType>::value)
+        return data()[size-1];
+    throw std::runtime_error("Inverse search failed");
+    return data()[size-1];
 }
 
 
@@ -169,115 +333,924 @@ FreqType RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::ins
     if (number == 0)
         return number;
 
-    if (size == 0) {
-        if (children[0] == nullptr) {
-            children[0] = std::make_shared<ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>>();
-            cached_sums[0] = 0; 
-            children[0]->parent = thisptr;
-        }
+    if (children[0] == null_node) {
+        ExternalNodeClusterType* leaf = ExternalNodeClusterType::factory(arena);
+        leaf->parent = thisptr;
+        children[0] = leaf->thisptr;
+        cached_sums[0] = 0; 
+    }
 
-        cached_sums[0] += number;
-        return children[0]->insert_sample(e, number);
-    } else {
-        unsigned index = utils::lower_or_equal_bound(data, size, e);
-        cached_sums[index] += number;
-        return children[index]->insert_sample(e, number);
+    // every cached sum is bounded by the total
+    if (overflow_check and utils::sum_overflows(total(), static_cast<CumFreqType>(number)))
+        throw std::runtime_error("insert_sample: sum of counts overflows");
+
+    struct Step {
+        RootNodeClusterType* cluster;
+        unsigned             index;
+    };
+    constexpr unsigned MaxDepth = 64;
+    Step path[MaxDepth];
+    unsigned depth = 0;
+
+    RootNodeClusterType* cluster = this;
+    NodeClusterType* child;
+    while (true) {
+        BOOST_ASSERT(depth < MaxDepth);
+        unsigned index = utils::lower_or_equal_bound(cluster->data, cluster->size, e);
+        utils::fenwick_add(cluster->cached_sums, cluster->size + 1, index, static_cast<CumFreqType>(number));
+        path[depth++] = {cluster, index};
+        child = node(cluster->children[index]);
+        if (child->leaf)
+            break;
+        cluster = static_cast<RootNodeClusterType*>(child);
     }
-}
 
-template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
-FreqType InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::insert_sample(Type e, FreqType number) {
-    BOOST_ASSERT(size > 0);
-    unsigned index = utils::lower_or_equal_bound(data, size, e);
-    cached_sums[index] += number;
-    return children[index]->insert_sample(e, number);
+    try {
+        return static_cast<ExternalNodeClusterType*>(child)->insert_sample(e, number);
+    } catch (...) {
+        // leaf is untouched when count of the element overflows
+        for (unsigned d = 0; d < depth; ++d)
+            utils::fenwick_add(path[d].cluster->cached_sums, path[d].cluster->size + 1, path[d].index, 
+                    CumFreqType(0) - static_cast<CumFreqType>(number));
+        throw;
+    }
 }
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
 FreqType ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::insert_sample(Type e, FreqType number) {
-    unsigned index = utils::lower_bound(data, size, e);
+    unsigned index = utils::lower_bound(data(), size, e);
+    bool stored = index < size and data()[index] == e;
+    FreqType count = stored ? frequency(index) : 0;
+    if (overflow_check and utils::sum_overflows(count, number))
+        throw std::runtime_error("insert_sample: count of element overflows");
+    count += number;
+
+    if (count > max_count(width)) {
+        // counts are widened, leaf is split when they do not fit into its page
+        std::vector<Type> keys(data(), data() + size);
+        std::vector<FreqType> counts;
+        for_each([&](Type, FreqType c) { counts.push_back(c); });
+        if (stored) {
+            counts[index] = count;
+        } else {
+            keys.insert(keys.begin() + index, e);
+            counts.insert(counts.begin() + index, count);
+        }
+        redistribute(keys, counts);
+        return count;
+    }
 
     // leaf has this element already saved
-    if (index < size and data[index] == e) { 
-        frequencies[index] += number;
-        return frequencies[index];
+    if (stored) { 
+        with_counts([&](auto counts) { counts[index] = count; });
+        block_sums[index / BlockSize] += number;
+        return count;
     } 
 
-    utils::insert_into_array(data, size, e, index);
-    utils::insert_into_array(frequencies, size, number, index);
+    utils::insert_into_array(data(), size, e, index);
+    with_counts([&](auto counts) {
+        utils::insert_into_array(counts, size, static_cast<std::remove_reference_t<decltype(*counts)>>(number), index);
+    });
     size += 1;
+    shift_block_sums(index);
 
-    if (size == MaxSize) // does not need to split
+    if (size == capacity()) // does not need to split
         split();
     return number;
 }
 
 
 ///////////////////////////////////////////////////
-/////////////////// min  + max elements ///////////
+////////////// remove_sample //////////////////////
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
-Type RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::minimal_element() const {
-    if (children[0]) 
-        return children[0]->minimal_element();
-    else
-        throw std::runtime_error("Mininal Element on empty tree");
+FreqType RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::remove_sample(Type e, FreqType number) {
+    if (children[0] == null_node or search_PDF(e) < number)
+        throw std::runtime_error("remove_sample: element is not stored in the tree that many times");
+    if (number == 0)
+        return search_PDF(e);
+
+    struct Step {
+        RootNodeClusterType* cluster;
+        unsigned             index;
+    };
+    constexpr unsigned MaxDepth = 64;
+    Step path[MaxDepth];
+    unsigned depth = 0;
+
+    RootNodeClusterType* cluster = this;
+    NodeClusterType* child;
+    while (true) {
+        BOOST_ASSERT(depth < MaxDepth);
+        unsigned index = utils::lower_or_equal_bound(cluster->data, cluster->size, e);
+        // unsigned wrap around subtracts the count
+        utils::fenwick_add(cluster->cached_sums, cluster->size + 1, index, CumFreqType(0) - number);
+        path[depth++] = {cluster, index};
+        child = node(cluster->children[index]);
+        if (child->leaf)
+            break;
+        cluster = static_cast<RootNodeClusterType*>(child);
+    }
+
+    ExternalNodeClusterType* leaf = static_cast<ExternalNodeClusterType*>(child);
+    FreqType remaining = leaf->remove_sample(e, number);
+
+    // last element of the tree is gone
+    if (leaf->size == 0 and depth == 1 and size == 0) {
+        arena->release(leaf->thisptr);
+        children[0] = null_node;
+        cached_sums[0] = 0;
+        return remaining;
+    }
+
+    // underfull clusters are fixed bottom-up, parents on the path stay in place
+    bool underfull = leaf->size < ExternalNodeClusterType::MinSize;
+    for (unsigned d = depth; d-- > 0 and underfull; ) {
+        RootNodeClusterType* parent_ptr = path[d].cluster;
+        if (parent_ptr->size == 0)
+            break;
+        parent_ptr->rebalance_child(path[d].index);
+        underfull = parent_ptr->size < MinSize;
+    }
+
+    if (size == 0 and not node(children[0])->leaf)
+        collapse();
+    return remaining;
 }
+
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
-Type RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::maximal_element() const {
-    if (children[0]) 
-        return children[size]->maximal_element();
+FreqType ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::remove_sample(Type e, FreqType number) {
+    unsigned index = utils::lower_bound(data(), size, e);
+    BOOST_ASSERT(index < size and data()[index] == e and frequency(index) >= number);
+
+    FreqType count = frequency(index) - number;
+    block_sums[index / BlockSize] -= number;
+    if (count > 0) {
+        with_counts([&](auto counts) { counts[index] = count; });
+        return count;
+    }
+
+    utils::erase_from_array(data(), size, index);
+    with_counts([&](auto counts) { utils::erase_from_array(counts, size, index); });
+    size -= 1;
+    unshift_block_sums(index);
+    return 0;
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::unshift_block_sums(unsigned index) {
+    // element with zero frequency was erased at index and the rest was shifted back,
+    // each following block passes its first element to the previous block
+    for (unsigned block = index / BlockSize; (block + 1) * BlockSize <= size; ++block) {
+        FreqType moved = frequency((block + 1) * BlockSize - 1);
+        block_sums[block] += moved;
+        block_sums[block + 1] -= moved;
+    }
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::rebalance_child(unsigned index) {
+    BOOST_ASSERT(size > 0);
+    unsigned left = index > 0 ? index - 1 : index;
+
+    utils::fenwick_unbuild(cached_sums, size + 1);
+    bool merged;
+    NodeClusterType* child = node(children[left]);
+    if (child->leaf)
+        merged = static_cast<ExternalNodeClusterType*>(child)->rebalance(
+                static_cast<ExternalNodeClusterType*>(node(children[left + 1])),
+                data[left], cached_sums[left], cached_sums[left + 1]);
     else
-        throw std::runtime_error("Mininal Element on empty tree");
+        merged = static_cast<InternalNodeClusterType*>(child)->rebalance(
+                static_cast<InternalNodeClusterType*>(node(children[left + 1])),
+                data[left], cached_sums[left], cached_sums[left + 1]);
+    if (merged) {
+        arena->counters.merges += 1;
+        arena->release(children[left + 1]);
+        utils::erase_from_array(data, size, left);
+        utils::erase_from_array(cached_sums, size + 1, left + 1);
+        utils::erase_from_array(children, size + 1, left + 1);
+        size -= 1;
+    }
+    utils::fenwick_build(cached_sums, size + 1);
 }
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
-Type InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::minimal_element() const {
-    return children[0]->minimal_element();
+bool InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::rebalance(
+        InternalNodeClusterType* right, 
+        Type& pivot, 
+        CumFreqType& sum, 
+        CumFreqType& right_sum) 
+{
+    unsigned keys = size + 1 + right->size;
+    utils::fenwick_unbuild(cached_sums, size + 1);
+    utils::fenwick_unbuild(right->cached_sums, right->size + 1);
+
+    if (keys <= MaxSize * 3 / 4) {
+        data[size] = pivot;
+        std::memcpy(&data[size + 1], right->data, sizeof(data[0])*right->size);
+        std::memcpy(&cached_sums[size + 1], right->cached_sums, sizeof(cached_sums[0])*(right->size + 1));
+        std::memcpy(&children[size + 1], right->children, sizeof(children[0])*(right->size + 1));
+        for (unsigned i = size + 1; i < keys + 1; ++i)
+            node(children[i])->parent = thisptr;
+        size = keys;
+        utils::fenwick_build(cached_sums, size + 1);
+        sum += right_sum;
+        right_sum = 0;
+        return true;
+    }
+
+    // both clusters are concatenated around pivot and cut in half
+    Type         all_data[2 * MaxSize + 1];
+    CumFreqType  all_sums[2 * MaxSize + 2];
+    NodeIndex    all_children[2 * MaxSize + 2];
+    std::memcpy(all_data, data, sizeof(data[0])*size);
+    all_data[size] = pivot;
+    std::memcpy(&all_data[size + 1], right->data, sizeof(data[0])*right->size);
+    std::memcpy(all_sums, cached_sums, sizeof(cached_sums[0])*(size + 1));
+    std::memcpy(&all_sums[size + 1], right->cached_sums, sizeof(cached_sums[0])*(right->size + 1));
+    std::memcpy(all_children, children, sizeof(children[0])*(size + 1));
+    std::memcpy(&all_children[size + 1], right->children, sizeof(children[0])*(right->size + 1));
+
+    unsigned left_keys = keys / 2;
+    size = left_keys;
+    right->size = keys - left_keys - 1;
+    pivot = all_data[left_keys];
+
+    std::memcpy(data, all_data, sizeof(data[0])*size);
+    std::memcpy(cached_sums, all_sums, sizeof(cached_sums[0])*(size + 1));
+    std::memcpy(children, all_children, sizeof(children[0])*(size + 1));
+    std::memcpy(right->data, &all_data[left_keys + 1], sizeof(data[0])*right->size);
+    std::memcpy(right->cached_sums, &all_sums[left_keys + 1], sizeof(cached_sums[0])*(right->size + 1));
+    std::memcpy(right->children, &all_children[left_keys + 1], sizeof(children[0])*(right->size + 1));
+
+    CumFreqType total = sum + right_sum;
+    sum = 0;
+    for (unsigned i = 0; i < size + 1; ++i) {
+        node(children[i])->parent = thisptr;
+        sum += cached_sums[i];
+    }
+    right_sum = total - sum;
+    for (unsigned i = 0; i < right->size + 1; ++i)
+        node(right->children[i])->parent = right->thisptr;
+
+    utils::fenwick_build(cached_sums, size + 1);
+    utils::fenwick_build(right->cached_sums, right->size + 1);
+    return false;
 }
+
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
-Type InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::maximal_element() const {
-    return children[size]->maximal_element();
+bool ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::rebalance(
+        ExternalNodeClusterType* right, 
+        Type& pivot, 
+        CumFreqType& sum, 
+        CumFreqType& right_sum) 
+{
+    // both leaves are gathered, counts of different widths meet in FreqType
+    unsigned total = size + right->size;
+    Type     all_data[2 * MaxSize];
+    FreqType all_counts[2 * MaxSize];
+    std::copy(data(), data() + size, all_data);
+    std::copy(right->data(), right->data() + right->size, all_data + size);
+    with_counts([&](auto counts) { std::copy(counts, counts + size, all_counts); });
+    right->with_counts([&](auto counts) { std::copy(counts, counts + right->size, all_counts + size); });
+
+    if (total <= capacity_for(std::max(width, right->width)) * 3 / 4) {
+        assign(all_data, all_counts, total);
+        right->unlink();
+        sum += right_sum;
+        right_sum = 0;
+        return true;
+    }
+
+    // halves may need wider counts than before, the old boundary always fits
+    auto fits = [&](unsigned left_size) {
+        return left_size < capacity_for(width_for(*std::max_element(all_counts, all_counts + left_size))) and
+            total - left_size < capacity_for(width_for(*std::max_element(all_counts + left_size, all_counts + total)));
+    };
+    unsigned left_size = total / 2;
+    while (left_size != size and not fits(left_size))
+        left_size = left_size < size ? left_size + 1 : left_size - 1;
+    assign(all_data, all_counts, left_size);
+    right->assign(all_data + left_size, all_counts + left_size, total - left_size);
+
+    CumFreqType both = sum + right_sum;
+    sum = rank(size);
+    right_sum = both - sum;
+    pivot = right->data()[0];
+    return false;
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::collapse() {
+    BOOST_ASSERT(size == 0);
+    RootNodeClusterType* child = arena->template at<RootNodeClusterType>(children[0]);
+    NodeIndex child_index = children[0];
+
+    size = child->size;
+    std::memcpy(data, child->data, sizeof(data[0])*size);
+    std::memcpy(cached_sums, child->cached_sums, sizeof(cached_sums[0])*(size + 1));
+    std::memcpy(children, child->children, sizeof(children[0])*(size + 1));
+    for (unsigned i = 0; i < size + 1; ++i)
+        node(children[i])->parent = thisptr;
+    arena->release(child_index);
+}
+
+
+///////////////////////////////////////////////////
+////////////// scale //////////////////////////////
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::scale(
+        CumFreqType factor, 
+        FreqType threshold, 
+        std::vector<std::pair<Type, FreqType>>& negligible) 
+{
+    static_assert(std::is_floating_point<CumFreqType>::value and std::is_floating_point<FreqType>::value,
+            "Only floating point counts can be scaled");
+    if (children[0] == null_node)
+        return;
+
+    // Fenwick layout is linear, each partial sum scales on its own
+    for (unsigned i = 0; i < size + 1; ++i) {
+        cached_sums[i] *= factor;
+        NodeClusterType* child = node(children[i]);
+        if (child->leaf)
+            static_cast<ExternalNodeClusterType*>(child)->scale(factor, threshold, negligible);
+        else
+            static_cast<RootNodeClusterType*>(child)->scale(factor, threshold, negligible);
+    }
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::scale(
+        CumFreqType factor, 
+        FreqType threshold, 
+        std::vector<std::pair<Type, FreqType>>& negligible) 
+{
+    with_counts([&](auto counts) {
+        for (unsigned i = 0; i < size; ++i) {
+            counts[i] *= factor;
+            if (counts[i] < threshold)
+                negligible.push_back({data()[i], counts[i]});
+        }
+    });
+    for (unsigned block = 0; block * BlockSize < size; ++block)
+        block_sums[block] *= factor;
+}
+
+
+///////////////////////////////////////////////////
+////////////// insert_sorted //////////////////////
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::insert_sorted(
+        const Type* keys, 
+        const FreqType* counts, 
+        std::size_t count) 
+{
+    if (overflow_check) {
+        CumFreqType sum = total();
+        for (std::size_t i = 0; i < count; ++i) {
+            if (utils::sum_overflows(sum, static_cast<CumFreqType>(counts[i])))
+                throw std::runtime_error("insert_sorted: sum of counts overflows");
+            sum += counts[i];
+        }
+    }
+    if (children[0] == null_node) {
+        bulk_load(keys, counts, count);
+        return;
+    }
+
+    struct Step {
+        RootNodeClusterType* cluster;
+        unsigned             index;
+    };
+    constexpr unsigned MaxDepth = 64;
+    Step path[MaxDepth];
+    std::vector<Type> merged_keys;
+    std::vector<FreqType> merged_counts;
+
+    for (std::size_t begin = 0; begin < count; ) {
+        // descent to leaf of first key, the deepest pivot bounds the leaf from above
+        unsigned depth = 0;
+        bool bounded = false;
+        Type upper = Type();
+        RootNodeClusterType* cluster = this;
+        NodeClusterType* child;
+        while (true) {
+            BOOST_ASSERT(depth < MaxDepth);
+            unsigned index = utils::lower_or_equal_bound(cluster->data, cluster->size, keys[begin]);
+            if (index < cluster->size) {
+                upper = cluster->data[index];
+                bounded = true;
+            }
+            path[depth++] = {cluster, index};
+            child = node(cluster->children[index]);
+            if (child->leaf)
+                break;
+            cluster = static_cast<RootNodeClusterType*>(child);
+        }
+
+        // run of keys belonging to the leaf
+        std::size_t end = bounded ? std::lower_bound(keys + begin, keys + count, upper) - keys : count;
+        CumFreqType sum = 0;
+        for (std::size_t i = begin; i < end; ++i)
+            sum += counts[i];
+        for (unsigned d = 0; d < depth; ++d)
+            utils::fenwick_add(path[d].cluster->cached_sums, path[d].cluster->size + 1, path[d].index, sum);
+
+        try {
+            static_cast<ExternalNodeClusterType*>(child)->merge_sorted(
+                    keys + begin, counts + begin, end - begin, merged_keys, merged_counts);
+        } catch (...) {
+            // leaf is untouched when count of an element overflows, earlier runs stay inserted
+            for (unsigned d = 0; d < depth; ++d)
+                utils::fenwick_add(path[d].cluster->cached_sums, path[d].cluster->size + 1, path[d].index, CumFreqType(0) - sum);
+            throw;
+        }
+        begin = end;
+    }
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::merge_sorted(
+        const Type* keys, 
+        const FreqType* counts, 
+        std::size_t count,
+        std::vector<Type>& merged_keys, 
+        std::vector<FreqType>& merged_counts) 
+{
+    merged_keys.clear();
+    merged_counts.clear();
+    std::size_t i = 0, j = 0;
+    const Type* stored = data();
+    while (i < size or j < count) {
+        if (j == count or (i < size and stored[i] < keys[j])) {
+            merged_keys.push_back(stored[i]);
+            merged_counts.push_back(frequency(i++));
+        } else if (i == size or keys[j] < stored[i]) {
+            merged_keys.push_back(keys[j]);
+            merged_counts.push_back(counts[j++]);
+        } else {
+            FreqType current = frequency(i);
+            if (overflow_check and utils::sum_overflows(current, counts[j]))
+                throw std::runtime_error("insert_sorted: count of element overflows");
+            merged_keys.push_back(stored[i++]);
+            merged_counts.push_back(current + counts[j++]);
+        }
+    }
+    redistribute(merged_keys, merged_counts);
+}
+
+
+///////////////////////////////////////////////////
+////////////// sorted batch queries ///////////////
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::search_CDF_sorted(
+        const Type* keys, 
+        std::size_t count, 
+        CumFreqType* output) const 
+{
+    if (children[0] == null_node) {
+        std::fill(output, output + count, CumFreqType(0));
+        return;
+    }
+
+    for (std::size_t begin = 0; begin < count; ) {
+        CumFreqType base = 0;
+        bool bounded = false;
+        Type upper = Type();
+        const RootNodeClusterType* cluster = this;
+        const NodeClusterType* child;
+        while (true) {
+            unsigned index = utils::lower_or_equal_bound(cluster->data, cluster->size, keys[begin]);
+            base += utils::fenwick_prefix(cluster->cached_sums, index);
+            if (index < cluster->size) {
+                upper = cluster->data[index];
+                bounded = true;
+            }
+            child = node(cluster->children[index]);
+            if (child->leaf)
+                break;
+            cluster = static_cast<const RootNodeClusterType*>(child);
+        }
+
+        std::size_t end = bounded ? std::lower_bound(keys + begin, keys + count, upper) - keys : count;
+        static_cast<const ExternalNodeClusterType*>(child)->search_CDF_sorted(
+                keys + begin, end - begin, base, output + begin);
+        begin = end;
+    }
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::search_CDF_sorted(
+        const Type* keys, 
+        std::size_t count, 
+        CumFreqType base, 
+        CumFreqType* output) const 
+{
+    // rank is carried over from previous query, long jumps go through block sums
+    unsigned index = 0;
+    CumFreqType sum = 0;
+    with_counts([&](auto counts) {
+        for (std::size_t i = 0; i < count; ++i) {
+            unsigned next = index + utils::lower_or_equal_bound(data() + index, size - index, keys[i]);
+            if (next - index < BlockSize) {
+                for (; index < next; ++index)
+                    sum += counts[index];
+            } else {
+                sum = rank(next);
+                index = next;
+            }
+            output[i] = base + sum;
+        }
+    });
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::inverse_search_CDF_sorted(
+        const CumFreqType* sums, 
+        std::size_t count, 
+        Type* output) const 
+{
+    if (children[0] == null_node)
+        throw std::runtime_error("Inverse_search_CDF on empty tree");
+
+    for (std::size_t begin = 0; begin < count; ) {
+        CumFreqType remainder = sums[begin];
+        const RootNodeClusterType* cluster = this;
+        const NodeClusterType* child;
+        while (true) {
+            unsigned index = utils::fenwick_select(cluster->cached_sums, cluster->size + 1, remainder);
+            if (index > cluster->size)
+                throw std::runtime_error("Inverse search failed");
+            child = node(cluster->children[index]);
+            if (child->leaf)
+                break;
+            cluster = static_cast<const RootNodeClusterType*>(child);
+        }
+
+        const ExternalNodeClusterType* leaf = static_cast<const ExternalNodeClusterType*>(child);
+        CumFreqType base = sums[begin] - remainder;
+        std::size_t end = std::upper_bound(sums + begin, sums + count, base + leaf->rank(leaf->size)) - sums;
+        leaf->inverse_search_CDF_sorted(sums + begin, end - begin, base, output + begin);
+        begin = end;
+    }
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::inverse_search_CDF_sorted(
+        const CumFreqType* sums, 
+        std::size_t count, 
+        CumFreqType base, 
+        Type* output) const 
+{
+    unsigned index = 0;
+    CumFreqType sum = base;
+    with_counts([&](auto counts) {
+        for (std::size_t i = 0; i < count; ++i) {
+            while (index < size) {
+                if (index % BlockSize == 0 and sum + block_sums[index / BlockSize] < sums[i]) {
+                    sum += block_sums[index / BlockSize];
+                    index += BlockSize;
+                } else if (sum + counts[index] < sums[i]) {
+                    sum += counts[index++];
+                } else {
+                    break;
+                }
+            }
+            if (index >= size)
+                throw std::runtime_error("Inverse search failed");
+            output[i] = data()[index];
+        }
+    });
+}
+
+
+///////////////////////////////////////////////////
+/////////////////// copy on write /////////////////
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>*
+RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::copy_path(
+        Type e, 
+        std::unordered_set<NodeIndex>& copies, 
+        std::vector<NodeIndex>& retired) 
+{
+    RootNodeClusterType* root = this;
+    if (copies.count(thisptr) == 0) {
+        NodeIndex index = arena->template create<RootNodeClusterType>(*this);
+        root = arena->template at<RootNodeClusterType>(index);
+        root->thisptr = index;
+        copies.insert(index);
+        retired.push_back(thisptr);
+    }
+    if (children[0] == null_node)
+        return root;
+
+    RootNodeClusterType* cluster = root;
+    while (true) {
+        unsigned index = utils::lower_or_equal_bound(cluster->data, cluster->size, e);
+        NodeIndex original = cluster->children[index];
+        NodeClusterType* child = node(original);
+        if (copies.count(original) == 0) {
+            NodeIndex copy = child->leaf ? 
+                arena->template create<ExternalNodeClusterType>(*static_cast<ExternalNodeClusterType*>(child)) :
+                arena->template create<InternalNodeClusterType>(*static_cast<InternalNodeClusterType*>(child));
+            child = node(copy);
+            child->thisptr = copy;
+            child->parent = cluster->thisptr;
+            cluster->children[index] = copy;
+            copies.insert(copy);
+            retired.push_back(original);
+        }
+        if (child->leaf)
+            return root;
+        cluster = static_cast<RootNodeClusterType*>(child);
+    }
+}
+
+
+///////////////////////////////////////////////////
+/////////////////// iteration over leaves /////////
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::const_iterator::skip() {
+    while (leaf != nullptr and index >= leaf->size) {
+        index = 0;
+        leaf = leaf->next == null_node ? nullptr : leaf->arena->template at<ExternalNodeClusterType>(leaf->next);
+    }
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+typename RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::const_iterator&
+RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::const_iterator::operator++() {
+    ++index;
+    skip();
+    return *this;
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+typename RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::const_iterator
+RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::begin() const {
+    return const_iterator(first_leaf(), 0);
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+typename RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::const_iterator
+RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::lower_bound(Type e) const {
+    if (children[0] == null_node)
+        return end();
+    const ExternalNodeClusterType* leaf = find_leaf(e);
+    return const_iterator(leaf, utils::lower_bound(leaf->data(), leaf->size, e));
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+template<class Function>
+void RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::for_each_leaf(Function&& function) const {
+    for (const ExternalNodeClusterType* leaf = first_leaf(); leaf != nullptr; 
+            leaf = leaf->next == null_node ? nullptr : arena->template at<ExternalNodeClusterType>(leaf->next))
+        leaf->with_counts([&](auto counts) { function(leaf->data(), counts, leaf->size); });
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+std::size_t RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::distinct() const {
+    std::size_t count = 0;
+    for (const ExternalNodeClusterType* leaf = first_leaf(); leaf != nullptr; 
+            leaf = leaf->next == null_node ? nullptr : arena->template at<ExternalNodeClusterType>(leaf->next))
+        count += leaf->size;
+    return count;
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::export_to(Type* keys, FreqType* counts) const {
+    for_each_leaf([&](const Type* leaf_keys, auto leaf_counts, unsigned size) {
+        keys = std::copy(leaf_keys, leaf_keys + size, keys);
+        counts = std::copy(leaf_counts, leaf_counts + size, counts);
+    });
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+CumFreqType RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::rank_in(NodeIndex subtree, Type e, bool inclusive) const {
+    CumFreqType sum = 0;
+    const NodeClusterType* child = node(subtree);
+    while (not child->leaf) {
+        const RootNodeClusterType* cluster = static_cast<const RootNodeClusterType*>(child);
+        unsigned index = utils::lower_or_equal_bound(cluster->data, cluster->size, e);
+        sum += utils::fenwick_prefix(cluster->cached_sums, index);
+        child = node(cluster->children[index]);
+    }
+    const ExternalNodeClusterType* leaf = static_cast<const ExternalNodeClusterType*>(child);
+    unsigned index = inclusive ? utils::lower_or_equal_bound(leaf->data(), leaf->size, e) : utils::lower_bound(leaf->data(), leaf->size, e);
+    return sum + leaf->rank(index);
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+CumFreqType RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::range_count(Type lo, Type hi) const {
+    if (children[0] == null_node or hi < lo)
+        return 0;
+    // bounds share the path down to the cluster where they part, children
+    // between them count as a whole
+    const RootNodeClusterType* cluster = this;
+    while (true) {
+        unsigned first = utils::lower_or_equal_bound(cluster->data, cluster->size, lo);
+        unsigned last = utils::lower_or_equal_bound(cluster->data, cluster->size, hi);
+        if (first != last)
+            return utils::fenwick_prefix(cluster->cached_sums, last) - utils::fenwick_prefix(cluster->cached_sums, first)
+                - rank_in(cluster->children[first], lo, false) + rank_in(cluster->children[last], hi, true);
+        const NodeClusterType* child = node(cluster->children[first]);
+        if (child->leaf)
+            return rank_in(cluster->children[first], hi, true) - rank_in(cluster->children[first], lo, false);
+        cluster = static_cast<const RootNodeClusterType*>(child);
+    }
+}
+
+
+///////////////////////////////////////////////////
+/////////////////// min  + max elements ///////////
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+template<class Function>
+void RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::for_each(Function&& function) const {
+    if (children[0] == null_node)
+        return;
+    for (unsigned i = 0; i < size + 1; ++i)
+        visit_child(children[i], [&](auto child) { child->for_each(function); });
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+template<class Function>
+void ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::for_each(Function&& function) const {
+    with_counts([&](auto counts) {
+        for (unsigned i = 0; i < size; ++i)
+            function(data()[i], static_cast<FreqType>(counts[i]));
+    });
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::export_sorted(
+        std::vector<Type>& keys, 
+        std::vector<FreqType>& counts) const 
+{
+    for_each([&](Type key, FreqType count) {
+        keys.push_back(key);
+        counts.push_back(count);
+    });
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+CumFreqType RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::total() const {
+    if (children[0] == null_node)
+        return 0;
+    return utils::fenwick_prefix(cached_sums, size + 1);
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+Type RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::minimal_element() const {
+    if (children[0] == null_node) 
+        throw std::runtime_error("Mininal Element on empty tree");
+
+    const NodeClusterType* child = node(children[0]);
+    while (not child->leaf)
+        child = node(static_cast<const RootNodeClusterType*>(child)->children[0]);
+    return static_cast<const ExternalNodeClusterType*>(child)->minimal_element();
+}
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+Type RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::maximal_element() const {
+    if (children[0] == null_node) 
+        throw std::runtime_error("Mininal Element on empty tree");
+
+    const NodeClusterType* child = node(children[size]);
+    while (not child->leaf) {
+        const RootNodeClusterType* cluster = static_cast<const RootNodeClusterType*>(child);
+        child = node(cluster->children[cluster->size]);
+    }
+    return static_cast<const ExternalNodeClusterType*>(child)->maximal_element();
 }
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
 Type ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::minimal_element() const {
-    return data[0];
+    return data()[0];
 }
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
 Type ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::maximal_element() const {
-    return data[size-1];
+    return data()[size-1];
 }
 ///////////////////////////////////////////////////
 ///////////////// FACTORY       ///////////////////
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
 std::shared_ptr<RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>> RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::factory() {
-    auto x = std::make_shared<RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>>();
-    x->thisptr = x;
-    return x;
+    // root owns the arena of the whole tree, the returned pointer keeps it alive
+    auto a = std::make_shared<NodeArenaType>();
+    NodeIndex index = a->template create<RootNodeClusterType>();
+    RootNodeClusterType* x = a->template at<RootNodeClusterType>(index);
+    x->arena = a.get();
+    x->thisptr = index;
+    return RootNodeClusterPtrType(a, x);
 }
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
-std::shared_ptr<InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>> InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::factory() {
-    auto x = std::make_shared<InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>>();
-    x->thisptr = x;
+InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>* InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::factory(NodeArenaType* a) {
+    NodeIndex index = a->template create<InternalNodeClusterType>();
+    InternalNodeClusterType* x = a->template at<InternalNodeClusterType>(index);
+    x->arena = a;
+    x->thisptr = index;
     return x;
 }
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
-std::shared_ptr<ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>> ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::factory() {
-    auto x = std::make_shared<ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>>();
-    x->thisptr = x;
+ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>* ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::factory(NodeArenaType* a) {
+    NodeIndex index = a->template create<ExternalNodeClusterType>();
+    ExternalNodeClusterType* x = a->template at<ExternalNodeClusterType>(index);
+    x->arena = a;
+    x->thisptr = index;
     return x;
 }
 
+///////////////////////////////////////////////////
+///////////////// Bulk load     ///////////////////
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+void RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::bulk_load(
+        const Type* keys, 
+        const FreqType* counts, 
+        std::size_t count) 
+{
+    if (children[0] != null_node)
+        throw std::runtime_error("Bulk load into non-empty tree");
+    if (count == 0)
+        return;
+
+    struct Packed {
+        NodeIndex   index;
+        Type        minimal;
+        CumFreqType sum;
+    };
+
+    auto adopt = [this](RootNodeClusterType* cluster, const Packed* packed, std::size_t number) {
+        CumFreqType sum = 0;
+        for (std::size_t i = 0; i < number; ++i) {
+            cluster->children[i] = packed[i].index;
+            cluster->cached_sums[i] = packed[i].sum;
+            if (i > 0)
+                cluster->data[i-1] = packed[i].minimal;
+            node(packed[i].index)->parent = cluster->thisptr;
+            sum += packed[i].sum;
+        }
+        cluster->size = number - 1;
+        utils::fenwick_build(cluster->cached_sums, number);
+        return sum;
+    };
+
+    // leaves are filled evenly up to capacity-1 elements (full leaf would split),
+    // runs with counts too wide for that are spread over more leaves
+    constexpr unsigned leaf_capacity = ExternalNodeClusterType::capacity_for(ExternalNodeClusterType::NarrowestWidth) - 1;
+    ExternalNodeClusterType* previous = nullptr;
+    std::vector<Packed> level;
+    std::size_t runs = (count + leaf_capacity - 1) / leaf_capacity;
+    level.reserve(runs);
+    for (std::size_t r = 0; r < runs; ++r) {
+        std::size_t run_begin = count * r / runs, run_end = count * (r + 1) / runs;
+        unsigned width = ExternalNodeClusterType::width_for(*std::max_element(counts + run_begin, counts + run_end));
+        std::size_t capacity = ExternalNodeClusterType::capacity_for(width) - 1;
+        std::size_t leaves = (run_end - run_begin + capacity - 1) / capacity;
+        for (std::size_t l = 0; l < leaves; ++l) {
+            std::size_t begin = run_begin + (run_end - run_begin) * l / leaves;
+            std::size_t end = run_begin + (run_end - run_begin) * (l + 1) / leaves;
+            ExternalNodeClusterType* leaf = ExternalNodeClusterType::factory(arena);
+            leaf->assign(keys + begin, counts + begin, end - begin);
+            if (previous != nullptr)
+                previous->link(leaf);
+            previous = leaf;
+            level.push_back({leaf->thisptr, keys[begin], leaf->rank(leaf->size)});
+        }
+    }
+
+    // internal clusters have at most MaxSize children as the root has
+    while (level.size() > MaxSize) {
+        std::size_t clusters = (level.size() + MaxSize - 1) / MaxSize;
+        std::vector<Packed> upper;
+        upper.reserve(clusters);
+        for (std::size_t c = 0; c < clusters; ++c) {
+            std::size_t begin = level.size() * c / clusters, end = level.size() * (c + 1) / clusters;
+            InternalNodeClusterType* cluster = InternalNodeClusterType::factory(arena);
+            CumFreqType sum = adopt(cluster, &level[begin], end - begin);
+            upper.push_back({cluster->thisptr, level[begin].minimal, sum});
+        }
+        level.swap(upper);
+    }
+    adopt(this, level.data(), level.size());
+}
+
 ///////////////////////////////////////////////////
 ///////////////// Register split ///////////////////
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
 void RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::register_split(
-        std::shared_ptr<NodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>> other, 
+        NodeIndex other, 
         Type pivot,
         CumFreqType sum) 
 {
@@ -286,15 +1259,21 @@ void RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::registe
     BOOST_ASSERT(index <= size);
     BOOST_ASSERT(sum > 0);
 
+    utils::fenwick_unbuild(cached_sums, size+1);
     utils::insert_into_array(data, size, pivot, index); 
     utils::insert_into_array(cached_sums, size+1, sum, index+1); 
-    utils::insert_array_safe(children, size+1, index+1, other);
+    utils::insert_into_array(children, size+1, other, index+1);
     size += 1;
-    other->parent = thisptr;
+    node(other)->parent = thisptr;
     cached_sums[index] -= sum;
+    utils::fenwick_build(cached_sums, size+1);
 
-    if (size == MaxSize)
-        split();
+    if (size == MaxSize) {
+        if (parent == null_node)
+            split();
+        else
+            static_cast<InternalNodeClusterType*>(this)->split();
+    }
 }
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
@@ -302,26 +1281,31 @@ void RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::split()
     constexpr unsigned size_small = (MaxSize-1)/2;
     constexpr unsigned pivot_index = (MaxSize-1)/2;
     constexpr unsigned size_big = (MaxSize)/2;
+    arena->counters.internal_splits += 1;
 
     // create greater element
-    auto small_ptr = InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::factory();
-    auto big_ptr   = InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::factory();
+    InternalNodeClusterType* small_ptr = InternalNodeClusterType::factory(arena);
+    InternalNodeClusterType* big_ptr   = InternalNodeClusterType::factory(arena);
 
     // data
     std::memmove(small_ptr->data, &data[0],             sizeof(data[0])*size_small);
     std::memmove(big_ptr->data,   &data[pivot_index+1], sizeof(data[0])*size_big);
 
     // cached_sums
+    utils::fenwick_unbuild(cached_sums, MaxSize+1);
     CumFreqType s1 = 0, s2 = 0;
     for (unsigned i = 0; i < size_small + 1; ++i)
         s1 += cached_sums[i];
-    for (unsigned i = size_small + 1; i < MaxSize; ++i)
+    for (unsigned i = size_small + 1; i < MaxSize + 1; ++i)
         s2 += cached_sums[i];
     std::memmove(small_ptr->cached_sums, &cached_sums[0],            sizeof(cached_sums[0])*(size_small+1));
     std::memmove(big_ptr->cached_sums,   &cached_sums[size_small+1], sizeof(cached_sums[0])*(size_big+1));
+    utils::fenwick_build(small_ptr->cached_sums, size_small+1);
+    utils::fenwick_build(big_ptr->cached_sums,   size_big+1);
 
     // ptrs
-    utils::two_way_array_move(children, small_ptr->children, big_ptr->children, pivot_index);
+    std::memmove(small_ptr->children, &children[0],             sizeof(children[0])*(size_small+1));
+    std::memmove(big_ptr->children,   &children[pivot_index+1], sizeof(children[0])*(size_big+1));
 
     // size
     small_ptr->size = size_small;
@@ -333,23 +1317,24 @@ void RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::split()
 
     // change children
     for (unsigned i = 0; i < big_ptr->size + 1; ++i) {
-        BOOST_ASSERT(big_ptr->children[i] != nullptr);
-        big_ptr->children[i]->parent = big_ptr;
+        BOOST_ASSERT(big_ptr->children[i] != null_node);
+        node(big_ptr->children[i])->parent = big_ptr->thisptr;
     }
     for (unsigned i = 0; i < small_ptr->size + 1; ++i) {
-        BOOST_ASSERT(big_ptr->children[i] != nullptr);
-        small_ptr->children[i]->parent = small_ptr;
+        BOOST_ASSERT(small_ptr->children[i] != null_node);
+        node(small_ptr->children[i])->parent = small_ptr->thisptr;
     }
 
     // roots pivot
     data[0] = data[pivot_index];
     size = 1;
     // roots ptrs
-    children[0] = small_ptr;
-    children[1] = big_ptr;
+    children[0] = small_ptr->thisptr;
+    children[1] = big_ptr->thisptr;
 
     cached_sums[0] = s1;
     cached_sums[1] = s2;
+    utils::fenwick_build(cached_sums, 2);
 }
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
@@ -357,54 +1342,143 @@ void InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::spl
     constexpr unsigned size_less = (MaxSize)/2; 
     constexpr unsigned pivot_index = (MaxSize)/2;
     constexpr unsigned size_big = (MaxSize-1)/2;
+    arena->counters.internal_splits += 1;
 
     Type new_pivot = data[pivot_index];
 
     // create greater element
-    std::shared_ptr<InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>> big_ptr = InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::factory();
+    InternalNodeClusterType* big_ptr = InternalNodeClusterType::factory(arena);
 
     // data
     std::memmove(big_ptr->data,     &data[pivot_index+1],     sizeof(data[0])*size_big);
 
     // cached sums
+    utils::fenwick_unbuild(cached_sums, MaxSize+1);
     CumFreqType sum = 0;
     for (unsigned i = pivot_index+1; i < MaxSize+1; ++i)
         sum += cached_sums[i];
     std::memmove(big_ptr->cached_sums, &cached_sums[pivot_index+1], sizeof(cached_sums[0])*(size_big+1));
+    utils::fenwick_build(big_ptr->cached_sums, size_big+1);
+    utils::fenwick_build(cached_sums, size_less+1);
     
     // ptrs
-    utils::one_way_array_move(children, big_ptr->children, pivot_index);
+    std::memmove(big_ptr->children, &children[pivot_index+1], sizeof(children[0])*(size_big+1));
     // size
     big_ptr->size = size_big;
     // parent
     big_ptr->parent = parent;
     // change children
     for (unsigned i = 0; i < big_ptr->size + 1; ++i)
-        big_ptr->children[i]->parent = big_ptr;
+        node(big_ptr->children[i])->parent = big_ptr->thisptr;
     // node size
     size = size_less;
     // his pivot
-    parent.lock()->register_split(big_ptr, new_pivot, sum);
+    arena->template at<RootNodeClusterType>(parent)->register_split(big_ptr->thisptr, new_pivot, sum);
 }
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
 void ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::split() {
-    constexpr unsigned half = (MaxSize) / 2;
-    std::shared_ptr<ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>> greater_ptr = ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::factory();
+    // greater half keeps the width of counts
+    unsigned half = size / 2;
+    ExternalNodeClusterType* greater_ptr = ExternalNodeClusterType::factory(arena);
+    greater_ptr->width = width;
+    link(greater_ptr);
+    arena->counters.leaf_splits += 1;
+
+    std::memcpy(greater_ptr->data(), &data()[half], sizeof(Type)*(size - half));
+    std::memcpy(greater_ptr->counts_bytes(), counts_bytes() + half * width, width*(size - half));
+    CumFreqType sum = rank(size) - rank(half);
+
+    greater_ptr->size = size - half;
+    size = half;
+    greater_ptr->update_block_sums(0);
+    update_block_sums(0);
 
-    std::memmove(greater_ptr->data, &data[half], sizeof(data[0])*(MaxSize - half));
-    //std::memset(&data[half], 0, sizeof(data[0])*(MaxSize - half));
-    CumFreqType sum = 0;
-    //for (unsigned i = half; i < MaxSize - half; ++i)
-    for (unsigned i = half; i < MaxSize; ++i)
-        sum += frequencies[i];
-    std::memmove(greater_ptr->frequencies, &frequencies[half], sizeof(frequencies[0])*(MaxSize - half));
-    //std::memset(&frequencies[half], 0, sizeof(frequencies[0])*(MaxSize - half));
+    arena->template at<RootNodeClusterType>(parent)->register_split(greater_ptr->thisptr, greater_ptr->data()[0], sum);
+}
 
-    greater_ptr->size = MaxSize - half;
-    size = half;
 
-    parent.lock()->register_split(greater_ptr, greater_ptr->data[0], sum);
+///////////////////////////////////////////////////
+//////////////////// Statistics ///////////////////
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+CDFTreeStats RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::stats() const {
+    CDFTreeStats stats;
+    double internal_fill = 0, leaf_fill = 0;
+    // clusters are visited level by level, all leaves are at the same depth
+    std::vector<NodeIndex> level = {thisptr}, next;
+    while (not level.empty()) {
+        stats.nodes_per_level.push_back(level.size());
+        next.clear();
+        for (NodeIndex index : level) {
+            const NodeClusterType* cluster = node(index);
+            if (cluster->leaf) {
+                const ExternalNodeClusterType* leaf = static_cast<const ExternalNodeClusterType*>(cluster);
+                stats.leaves += 1;
+                stats.distinct += leaf->size;
+                leaf_fill += static_cast<double>(leaf->size) / leaf->capacity();
+            } else {
+                const RootNodeClusterType* internal = static_cast<const RootNodeClusterType*>(cluster);
+                stats.internal_nodes += 1;
+                internal_fill += static_cast<double>(internal->size) / MaxSize;
+                for (unsigned i = 0; i < internal->size + 1; ++i)
+                    if (internal->children[i] != null_node)
+                        next.push_back(internal->children[i]);
+            }
+        }
+        level.swap(next);
+    }
+    stats.height = stats.nodes_per_level.size();
+    stats.internal_fill = internal_fill / stats.internal_nodes;
+    stats.leaf_fill = stats.leaves == 0 ? 0. : leaf_fill / stats.leaves;
+    stats.total = total();
+    stats.leaf_splits = arena->counters.leaf_splits;
+    stats.internal_splits = arena->counters.internal_splits;
+    stats.merges = arena->counters.merges;
+    stats.used_bytes = used_bytes();
+    stats.reserved_bytes = arena->reserved_bytes();
+    stats.allocated_bytes = allocated_bytes();
+    return stats;
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+unsigned RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::height() const {
+    unsigned height = 1;
+    for (NodeIndex index = children[0]; index != null_node; ++height) {
+        const NodeClusterType* cluster = node(index);
+        index = cluster->leaf ? null_node : static_cast<const RootNodeClusterType*>(cluster)->children[0];
+    }
+    return height;
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+std::size_t RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::pages_for_insert(std::size_t keys) const {
+    // Single element splits its leaf into two, or spreads it over more pieces when
+    // counts get wider: a full leaf of 1 byte counts over leaves of the widest ones,
+    // two for keys of 4 bytes and more, three for smaller keys. Every cluster on the
+    // path splits at most once, as one split leaves it half empty, root into two new ones.
+    std::size_t levels = height();
+    constexpr std::size_t widest = ExternalNodeClusterType::capacity_for(sizeof(FreqType)) - 1;
+    constexpr std::size_t widened = (ExternalNodeClusterType::capacity_for(ExternalNodeClusterType::NarrowestWidth) + widest - 1) / widest;
+    if (keys <= 1)
+        return levels + std::max<std::size_t>(widened, 2) - 1;
+    // touched leaf with k new elements becomes at most 2 + k/capacity pieces,
+    // clusters split off are at least half full, each level adds a few partial ones
+    constexpr std::size_t capacity = ExternalNodeClusterType::capacity_for(sizeof(FreqType)) - 1;
+    std::size_t leaves = 2 * keys + keys / capacity + 1;
+    return leaves + 2 * leaves / (MaxSize / 2) + 2 * levels;
+}
+
+template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
+std::size_t RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::pages_for_insert(Type e, FreqType number) const {
+    // stored element whose count still fits the width of its leaf needs no page
+    if (children[0] != null_node) {
+        const ExternalNodeClusterType* leaf = find_leaf(e);
+        FreqType count = leaf->search_PDF(e);
+        if (count != 0 and number <= ExternalNodeClusterType::max_count(leaf->width) - count)
+            return 0;
+    }
+    return pages_for_insert(1);
 }
 
 
@@ -422,16 +1496,24 @@ void RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::sanity_
         BOOST_ASSERT(data[i-1] < data[i]);
 
     // filled children
-    if (size != 0 or children[0] != nullptr)
+    if (size != 0 or children[0] != null_node)
         for (unsigned i = 0; i < size + 1; ++i) {
-            BOOST_ASSERT(children[i] != nullptr);
-            BOOST_ASSERT(children[i]->parent.lock() == thisptr.lock());
-            children[i]->sanity_check();
+            BOOST_ASSERT(children[i] != null_node);
+            BOOST_ASSERT(node(children[i])->parent == thisptr);
+            visit_child(children[i], [](auto child) { child->sanity_check(); });
         }
 
     for (unsigned i = 0; i < size; ++i) {
-        BOOST_ASSERT(children[i]->maximal_element() < data[i]);
-        BOOST_ASSERT(children[i+1]->minimal_element() >= data[i]);
+        BOOST_ASSERT(visit_child(children[i], [](auto child) { return child->maximal_element(); }) < data[i]);
+        BOOST_ASSERT(visit_child(children[i+1], [](auto child) { return child->minimal_element(); }) >= data[i]);
+    }
+
+    // chain of leaves runs through all of them
+    if (children[0] != null_node) {
+        BOOST_ASSERT(first_leaf()->prev == null_node);
+        std::size_t leaves = 0;
+        for_each_leaf([&](const Type*, auto, unsigned) { ++leaves; });
+        BOOST_ASSERT(leaves == stats().leaves);
     }
 }
 
@@ -446,18 +1528,16 @@ void InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::san
 
     // filled children & backptrs
     for (unsigned i = 0; i < size + 1; ++i) {
-        BOOST_ASSERT(children[i] != nullptr);
-        BOOST_ASSERT(children[i]->parent.lock() == thisptr.lock());
-        children[i]->sanity_check();
+        BOOST_ASSERT(children[i] != null_node);
+        BOOST_ASSERT(node(children[i])->parent == thisptr);
+        this->visit_child(children[i], [](auto child) { child->sanity_check(); });
     }
 
     // sum of node cache are equal to parent cache
-    RootNodeClusterType* parent = dynamic_cast<RootNodeClusterType*>(this->parent.lock().get());
+    RootNodeClusterType* parent = arena->template at<RootNodeClusterType>(this->parent);
     unsigned index_of_parent = utils::lower_or_equal_bound(parent->data, parent->size, data[0]);
-    unsigned long long sum = 0;
-    for(unsigned i = 0; i < size + 1; ++i) 
-        sum += cached_sums[i];
-    BOOST_ASSERT(parent->cached_sums[index_of_parent] == sum);
+    CumFreqType sum = utils::fenwick_prefix(cached_sums, size + 1);
+    BOOST_ASSERT(utils::fenwick_value(parent->cached_sums, index_of_parent) == sum);
 }
 
 
@@ -465,18 +1545,34 @@ template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool
 void ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::sanity_check() const {
     // size
     BOOST_ASSERT(size >= 1);
-    BOOST_ASSERT(size < MaxSize);
+    BOOST_ASSERT(size < capacity());
 
     // order
     for (unsigned i = 1; i < size; ++i)
-        BOOST_ASSERT(data[i-1] < data[i]);
+        BOOST_ASSERT(data()[i-1] < data()[i]);
 
-    RootNodeClusterType* parent = dynamic_cast<RootNodeClusterType*>(this->parent.lock().get());
-    unsigned index_of_parent = utils::lower_or_equal_bound(parent->data, parent->size, data[0]);
-    unsigned long long sum = 0;
+    RootNodeClusterType* parent = arena->template at<RootNodeClusterType>(this->parent);
+    unsigned index_of_parent = utils::lower_or_equal_bound(parent->data, parent->size, data()[0]);
+    CumFreqType sum = 0;
     for(unsigned i = 0; i < size; ++i) 
-        sum += frequencies[i];
-    BOOST_ASSERT(parent->cached_sums[index_of_parent] == sum);
+        sum += frequency(i);
+    BOOST_ASSERT(utils::fenwick_value(parent->cached_sums, index_of_parent) == sum);
+
+    for (unsigned block = 0; block * BlockSize < size; ++block) {
+        CumFreqType block_sum = 0;
+        for (unsigned i = block * BlockSize; i < std::min(size, (block + 1) * BlockSize); ++i)
+            block_sum += frequency(i);
+        BOOST_ASSERT(block_sums[block] == block_sum);
+    }
+
+    // chain of leaves
+    if (next != null_node) {
+        const ExternalNodeClusterType* greater = arena->template at<ExternalNodeClusterType>(next);
+        BOOST_ASSERT(greater->prev == thisptr);
+        BOOST_ASSERT(data()[size-1] < greater->data()[0]);
+    }
+    if (prev != null_node)
+        BOOST_ASSERT(arena->template at<ExternalNodeClusterType>(prev)->next == thisptr);
 
 }
 
@@ -5,8 +5,25 @@
 #include <memory>
 #include <array>
 #include <cmath>
+#include <vector>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <type_traits>
+#include <unordered_set>
+#include <queue>
+#include <string>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
 #include <boost/assert.hpp>
 
+#include "node_arena.h"
+#include "memory_accounting.h"
+#include "array_manip.h"
+#include "key_traits.h"
+#include "parallel.h"
+
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
 class RootNodeCluster;
 
@@ -17,6 +34,26 @@ template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool
 class ExternalNodeCluster;
 
 
+// shape of a tree, collected by walking all of its clusters
+struct CDFTreeStats {
+    unsigned                    height = 0;             // levels of clusters, root and leaves included
+    std::vector<std::size_t>    nodes_per_level;        // root level first
+    std::size_t                 internal_nodes = 0;     // root included
+    std::size_t                 leaves = 0;
+    double                      internal_fill = 0;      // average keys / MaxSize of root and internal clusters
+    double                      leaf_fill = 0;          // average elements / capacity of leaves
+    std::size_t                 distinct = 0;           // stored elements
+    unsigned long long          total = 0;              // sum of all counts
+    // structural changes since the tree was created, cleared or rebuilt
+    unsigned long long          leaf_splits = 0;
+    unsigned long long          internal_splits = 0;    // root included
+    unsigned long long          merges = 0;
+    std::size_t                 used_bytes = 0;         // pages in use
+    std::size_t                 reserved_bytes = 0;     // pages obtained from the system
+    std::size_t                 allocated_bytes = 0;    // pages and page directories, see MemoryRegistry
+};
+
+
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
 std::ostream& operator<< (
         std::ostream&, 
@@ -35,31 +72,24 @@ std::ostream& operator<< (
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
 class NodeCluster {
+    // Common header of all clusters. There are no virtual functions, the kind of
+    // cluster is stored in the header and the tree is traversed iteratively
+    // from RootNodeCluster, so the whole descent can be inlined.
     using NodeClusterType = NodeCluster<Type, PageSize, FreqType, CumFreqType, overflow_check>;
-    using NodeClusterPtrType = std::shared_ptr<NodeCluster<Type, PageSize, FreqType, CumFreqType, overflow_check>>;
-
-    virtual ~NodeCluster() {}
-
-    // element -> probability
-    virtual FreqType search_PDF(Type) const = 0;
-    // update
-    virtual FreqType insert_sample(Type, FreqType number=1) = 0;
-    // element -> cummulative probability
-    virtual CumFreqType search_CDF(Type e) const = 0;
-    // cummulative proabibility -> element
-    virtual Type inverse_search_CDF(CumFreqType cdf) const = 0;
+    using NodeArenaType = NodeArena<PageSize>;
 
-    virtual Type minimal_element() const = 0;
-    virtual Type maximal_element() const = 0;
-    
-    virtual void print(unsigned) const = 0;
-    virtual void sanity_check () const = 0;
+    NodeCluster() : arena(nullptr), parent(null_node), thisptr(null_node), size(0), leaf(false) {}
 
-    virtual void register_split(NodeClusterPtrType, Type pivot, CumFreqType sum) = 0;
+    NodeClusterType* node(NodeIndex index) const {
+        return arena->template at<NodeClusterType>(index);
+    }
 
-    std::weak_ptr<NodeClusterType> parent;
-    std::weak_ptr<NodeClusterType> thisptr;
+    // clusters live in pages of the tree's arena and are linked by indices
+    NodeArenaType* arena;
+    NodeIndex    parent;
+    NodeIndex    thisptr;
     unsigned     size;
+    bool         leaf;      // ExternalNodeCluster, otherwise Root/InternalNodeCluster
 
     friend class RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>;
     friend class InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>;
@@ -83,50 +113,146 @@ template<
 class RootNodeCluster: public NodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check> 
 {
 public:
-    virtual ~RootNodeCluster() {};
     RootNodeCluster();
 
     using NodeClusterType = NodeCluster<Type, PageSize, FreqType, CumFreqType, overflow_check>;
-    using NodeClusterPtrType = std::shared_ptr<NodeClusterType>;
+    using NodeArenaType = NodeArena<PageSize>;
     using RootNodeClusterType = RootNodeCluster<Type, PageSize, FreqType, CumFreqType, overflow_check>;
     using RootNodeClusterPtrType = std::shared_ptr<RootNodeClusterType>;
     using InternalNodeClusterType = InternalNodeCluster<Type, PageSize, FreqType, CumFreqType, overflow_check>;
-    using InternalNodeClusterPtrType = std::shared_ptr<InternalNodeClusterType>;
     using ExternalNodeClusterType = ExternalNodeCluster<Type, PageSize, FreqType, CumFreqType, overflow_check>;
-    using ExternalNodeClusterPtrType = std::shared_ptr<ExternalNodeClusterType>;
+    static constexpr unsigned PageBytes = PageSize;
 
     using NodeClusterType::size;
+    using NodeClusterType::parent;
     using NodeClusterType::thisptr;
+    using NodeClusterType::arena;
+    using NodeClusterType::node;
 
     static constexpr unsigned MaxSize = 
-        (PageSize - sizeof(NodeClusterType) - sizeof(NodeClusterPtrType) - sizeof(CumFreqType)) / 
-        (sizeof(CumFreqType) + sizeof(NodeClusterPtrType) + sizeof(Type));
-
-    //static_assert(sizeof(RootNodeClusterType) < PageSize, "Page size overflow");
-
-    virtual FreqType        insert_sample(Type, FreqType number=1) override;
-    virtual FreqType        search_PDF(Type) const override;
-    virtual CumFreqType     search_CDF(Type) const override;
-    virtual Type            inverse_search_CDF(CumFreqType) const override;
+        (PageSize - sizeof(NodeClusterType) - sizeof(NodeIndex) - sizeof(CumFreqType)) / 
+        (sizeof(CumFreqType) + sizeof(NodeIndex) + sizeof(Type));
+    // internal clusters below this are merged with or borrow from a neighbour
+    static constexpr unsigned MinSize = MaxSize / 4;
+
+    FreqType        insert_sample(Type, FreqType number=1);
+    // returns remaining count of element, throws if element is stored fewer times
+    FreqType        remove_sample(Type, FreqType number=1);
+    FreqType        search_PDF(Type) const;
+    CumFreqType     search_CDF(Type) const;
+    Type            inverse_search_CDF(CumFreqType) const;
 
     static RootNodeClusterPtrType factory();
+    // fills empty tree from strictly increasing keys, clusters are packed bottom-up
+    void bulk_load(const Type* keys, const FreqType* counts, std::size_t size);
+    // inserts strictly increasing keys, each touched leaf is visited once
+    void insert_sorted(const Type* keys, const FreqType* counts, std::size_t size);
+    // batch queries over non-decreasing input, each touched leaf is visited once
+    void search_CDF_sorted(const Type* keys, std::size_t size, CumFreqType* output) const;
+    void inverse_search_CDF_sorted(const CumFreqType* sums, std::size_t size, Type* output) const;
+    // multiplies all counts by factor (floating point counts only),
+    // elements whose scaled count drops below threshold are appended to negligible
+    void scale(CumFreqType factor, FreqType threshold, std::vector<std::pair<Type, FreqType>>& negligible);
 
-    virtual Type minimal_element() const override;
-    virtual Type maximal_element() const override;
-
-    virtual void print(unsigned x = 0) const override;
-    virtual void sanity_check () const override;
+    Type minimal_element() const;
+    Type maximal_element() const;
+    // sum of all counts
+    CumFreqType total() const;
+    // bytes of arena pages used by the tree
+    std::size_t used_bytes() const { return std::size_t(arena->used_pages()) * PageSize; }
+    // height, fill factors, split counters and memory of the tree
+    CDFTreeStats stats() const;
+    // levels including root and leaves
+    unsigned height() const;
+    // upper bounds of pages an insert of keys distinct elements (or of one element) may allocate
+    std::size_t pages_for_insert(std::size_t keys) const;
+    std::size_t pages_for_insert(Type, FreqType number) const;
+    // grows the arena so the next pages are created without more memory,
+    // returns false when the tree's or the process-wide limit does not allow it
+    bool reserve(std::size_t pages) { return arena->reserve(pages); }
+    // bytes the arena holds and the most reserve_for_insert may take (0 means no limit)
+    std::size_t allocated_bytes() const { return arena->allocated_bytes(); }
+    void set_memory_limit(std::size_t bytes) { arena->limit = bytes; }
+    // appends all elements and their counts in increasing order
+    void export_sorted(std::vector<Type>& keys, std::vector<FreqType>& counts) const;
+    // calls function(element, count) in increasing order
+    template<class Function>
+    void for_each(Function&& function) const;
+    // calls function(keys, counts, size) for leaves in increasing order, counts point
+    // to unsigned integers of the leaf's width (or FreqType), only links are followed
+    template<class Function>
+    void for_each_leaf(Function&& function) const;
+    // distinct elements, and all of them with their counts written to arrays of that size
+    std::size_t distinct() const;
+    void export_to(Type* keys, FreqType* counts) const;
+    // sum of counts of elements in [lo, hi], both paths are walked once
+    CumFreqType range_count(Type lo, Type hi) const;
+
+    // (element, count) pairs in increasing order, following links between leaves
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<Type, FreqType>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = value_type;
+
+        const_iterator() : leaf(nullptr), index(0) {}
+        value_type operator*() const { return {leaf->data()[index], leaf->frequency(index)}; }
+        const_iterator& operator++();
+        const_iterator operator++(int) { const_iterator old = *this; ++*this; return old; }
+        bool operator==(const const_iterator& other) const { return leaf == other.leaf and index == other.index; }
+        bool operator!=(const const_iterator& other) const { return not (*this == other); }
+
+    private:
+        const_iterator(const ExternalNodeClusterType* leaf, unsigned index) : leaf(leaf), index(index) { skip(); }
+        // moves over the end of leaf to the next one
+        void skip();
+
+        const ExternalNodeClusterType* leaf;    // nullptr at the end
+        unsigned index;
+
+        friend RootNodeCluster;
+    };
+    const_iterator begin() const;
+    const_iterator end() const { return const_iterator(); }
+    // first element not less than e
+    const_iterator lower_bound(Type) const;
+
+    void print(unsigned x = 0) const;
+    void sanity_check () const;
 protected:
-    virtual void register_split(NodeClusterPtrType, Type, CumFreqType) override;
+    // Copies this root and clusters on the path to element into fresh pages, returns the new root.
+    // Clusters listed in copies are private already and are modified in place, new copies are
+    // added there, replaced pages are appended to retired. Parents and links of shared clusters
+    // may be rewritten, search functions never read them (iterators do, they are not meant for copies).
+    RootNodeClusterType* copy_path(Type, std::unordered_set<NodeIndex>& copies, std::vector<NodeIndex>& retired);
+
+    // leaf where element belongs to, leaf of the smallest elements
+    const ExternalNodeClusterType* find_leaf(Type) const;
+    const ExternalNodeClusterType* first_leaf() const;
+    // sum of counts of elements below (or up to) e in subtree
+    CumFreqType rank_in(NodeIndex subtree, Type e, bool inclusive) const;
+
+    // calls visitor with child casted to its real type
+    template<class Visitor>
+    auto visit_child(NodeIndex, Visitor&&) const;
+
+    void register_split(NodeIndex, Type, CumFreqType);
     void split();
+    // child at index is underfull, it is merged with its neighbour or borrows from it
+    void rebalance_child(unsigned index);
+    // root with single internal child takes over its content
+    void collapse();
 
     Type         data [MaxSize];
-    CumFreqType  cached_sums[MaxSize+1];
-    std::array<NodeClusterPtrType, MaxSize+1> children;
+    CumFreqType  cached_sums[MaxSize+1];    // counts of children in Fenwick layout
+    NodeIndex    children[MaxSize+1];
 
     friend std::ostream& operator<<<>(std::ostream&, const RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>&);
     friend InternalNodeCluster<Type, PageSize, FreqType, CumFreqType, overflow_check>;
     friend ExternalNodeCluster<Type, PageSize, FreqType, CumFreqType, overflow_check>;
+    template<class> friend class SnapshotCDFTree;
 };
 
 
@@ -143,15 +269,12 @@ class InternalNodeCluster: public RootNodeCluster<Type, PageSize, FreqType, CumF
 {
 public:
     InternalNodeCluster();
-    virtual ~InternalNodeCluster() {}
 
 protected:
     using NodeClusterType = NodeCluster<Type, PageSize, FreqType, CumFreqType, overflow_check>;
-    using NodeClusterPtrType = std::shared_ptr<NodeClusterType>;
+    using NodeArenaType = NodeArena<PageSize>;
     using RootNodeClusterType = RootNodeCluster<Type, PageSize, FreqType, CumFreqType, overflow_check>;
-    using RootNodeClusterPtrType = std::shared_ptr<RootNodeClusterType>;
     using InternalNodeClusterType = InternalNodeCluster<Type, PageSize, FreqType, CumFreqType, overflow_check>;
-    using InternalNodeClusterPtrType = std::shared_ptr<InternalNodeClusterType>;
 
     using RootNodeClusterType::MaxSize;
     using RootNodeClusterType::children;
@@ -160,22 +283,17 @@ protected:
     using NodeClusterType::parent;
     using NodeClusterType::thisptr;
     using NodeClusterType::size;
+    using NodeClusterType::arena;
+    using NodeClusterType::node;
 
-    //static_assert(sizeof(InternalNodeClusterType) < PageSize, "Page size overflow");
-
-    virtual FreqType insert_sample(Type e, FreqType number=1) override;
-    virtual FreqType search_PDF(Type e) const override;
-    virtual CumFreqType search_CDF(Type e) const override;
-    virtual Type inverse_search_CDF(CumFreqType cdf) const override;
-
-    virtual Type minimal_element() const override; 
-    virtual Type maximal_element() const override;
-
-    virtual void print(unsigned) const override;
-    virtual void sanity_check () const override;
+    void print(unsigned) const;
+    void sanity_check () const;
 
-    static InternalNodeClusterPtrType factory();
+    static InternalNodeClusterType* factory(NodeArenaType*);
     void split();
+    // right neighbour is merged into this cluster (returns true) or keys are evened out,
+    // pivot between clusters and sums of both are updated
+    bool rebalance(InternalNodeClusterType* right, Type& pivot, CumFreqType& sum, CumFreqType& right_sum);
 
     friend class RootNodeCluster<Type, PageSize, FreqType, CumFreqType, overflow_check>;
     friend std::ostream& operator<<<>(std::ostream&, const InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>&);
@@ -196,46 +314,102 @@ class ExternalNodeCluster: public NodeCluster<Type,PageSize,FreqType,CumFreqType
 {
 public:
     ExternalNodeCluster();
-    virtual ~ExternalNodeCluster() {};
 
     using NodeClusterType = NodeCluster<Type, PageSize, FreqType, CumFreqType, overflow_check>;
+    // frequencies are summed per block so rank inside of leaf is few block additions
+    static constexpr unsigned BlockSize = 32;
+    // unsigned counts are stored in the narrowest width (1, 2 or 4 bytes) holding
+    // the largest count of the leaf, low counts leave room for more elements
+    static constexpr bool CompactCounts = std::is_integral<FreqType>::value and 
+        std::is_unsigned<FreqType>::value and sizeof(FreqType) > 1 and sizeof(FreqType) <= 4;
+    static constexpr unsigned NarrowestWidth = CompactCounts ? 1 : sizeof(FreqType);
+    // elements of a leaf with the narrowest counts
     static constexpr unsigned MaxSize = 
-        (PageSize - sizeof(NodeClusterType)) / (sizeof(FreqType) + sizeof(Type));
+        (PageSize - sizeof(NodeClusterType) - sizeof(CumFreqType) - 16) * BlockSize / 
+        (BlockSize * (NarrowestWidth + sizeof(Type)) + sizeof(CumFreqType));
+    static constexpr unsigned Blocks = (MaxSize + BlockSize - 1) / BlockSize;
+    static constexpr unsigned MinSize = MaxSize / 4;
+    // bytes shared by elements and counts (links, width and padding take 16 bytes)
+    static constexpr unsigned StorageSize = (PageSize - sizeof(NodeClusterType) - Blocks * sizeof(CumFreqType) - 16) / 8 * 8;
+
+    // leaf with counts of given width splits when it reaches this size
+    static constexpr unsigned capacity_for(unsigned width) {
+        return std::min<unsigned>(MaxSize, (StorageSize - (width - 1)) / (sizeof(Type) + width));
+    }
+    static unsigned width_for(FreqType count);
+    static FreqType max_count(unsigned width);
 
 protected:
-    using NodeClusterPtrType = std::shared_ptr<NodeClusterType>;
+    using NodeArenaType = NodeArena<PageSize>;
     using RootNodeClusterType = RootNodeCluster<Type, PageSize, FreqType, CumFreqType, overflow_check>;
-    using RootNodeClusterPtrType = std::shared_ptr<RootNodeClusterType>;
     using InternalNodeClusterType = InternalNodeCluster<Type, PageSize, FreqType, CumFreqType, overflow_check>;
-    using InternalNodeClusterPtrType = std::shared_ptr<InternalNodeClusterType>;
     using ExternalNodeClusterType = ExternalNodeCluster<Type, PageSize, FreqType, CumFreqType, overflow_check>;
-    using ExternalNodeClusterPtrType = std::shared_ptr<ExternalNodeClusterType>;
-
 
     using NodeClusterType::parent;
+    using NodeClusterType::thisptr;
     using NodeClusterType::size;
+    using NodeClusterType::arena;
+    using NodeClusterType::node;
+
+    FreqType        insert_sample(Type, FreqType);
+    FreqType        remove_sample(Type, FreqType);
+    FreqType        search_PDF(Type) const;
+    CumFreqType     search_CDF(Type) const;
+    Type            inverse_search_CDF(CumFreqType) const;
+    // base is the sum of frequencies left of this leaf
+    void search_CDF_sorted(const Type* keys, std::size_t size, CumFreqType base, CumFreqType* output) const;
+    void inverse_search_CDF_sorted(const CumFreqType* sums, std::size_t size, CumFreqType base, Type* output) const;
+    void scale(CumFreqType factor, FreqType threshold, std::vector<std::pair<Type, FreqType>>& negligible);
+    template<class Function>
+    void for_each(Function&& function) const;
 
+    Type minimal_element() const;
+    Type maximal_element() const;
 
-    //static_assert(sizeof(ExternalNodeClusterType) < PageSize, "Page size overflow");
-
-    virtual FreqType        insert_sample(Type, FreqType) override;
-    virtual FreqType        search_PDF(Type) const override;
-    virtual CumFreqType     search_CDF(Type) const override;
-    virtual Type            inverse_search_CDF(CumFreqType) const override;
-
-    virtual Type minimal_element() const override;
-    virtual Type maximal_element() const override;
-
-    static ExternalNodeClusterPtrType factory();
+    static ExternalNodeClusterType* factory(NodeArenaType*);
 
-    virtual void print(unsigned) const override;
-    virtual void sanity_check() const override;
+    void print(unsigned) const;
+    void sanity_check() const;
 
     void split();
-    virtual void register_split(NodeClusterPtrType, Type, CumFreqType) override {}
-
-    Type        data [MaxSize];
-    FreqType    frequencies[MaxSize];
+    // same as in InternalNodeCluster
+    bool rebalance(ExternalNodeClusterType* right, Type& pivot, CumFreqType& sum, CumFreqType& right_sum);
+
+    // merges sorted run into leaf, overflow is split into new leaves
+    void merge_sorted(const Type* keys, const FreqType* counts, std::size_t size,
+            std::vector<Type>& merged_keys, std::vector<FreqType>& merged_counts);
+
+    CumFreqType rank(unsigned index) const;
+    void update_block_sums(unsigned from_index);
+    void shift_block_sums(unsigned index);
+    void unshift_block_sums(unsigned index);
+
+    unsigned capacity() const { return capacity_for(width); }
+    Type* data() { return reinterpret_cast<Type*>(storage); }
+    const Type* data() const { return reinterpret_cast<const Type*>(storage); }
+    unsigned char* counts_bytes() { return storage + (capacity() * sizeof(Type) + width - 1) / width * width; }
+    const unsigned char* counts_bytes() const { return const_cast<ExternalNodeClusterType*>(this)->counts_bytes(); }
+    FreqType frequency(unsigned index) const;
+    // calls function with pointer to counts of the current width
+    template<class Function>
+    decltype(auto) with_counts(Function&& function) const;
+    template<class Function>
+    decltype(auto) with_counts(Function&& function);
+    // stores strictly increasing run (shorter than its capacity) in the narrowest width
+    void assign(const Type* keys, const FreqType* counts, unsigned count);
+    // stores run in this leaf and as many new leaves as its length and width need
+    void redistribute(const std::vector<Type>& keys, const std::vector<FreqType>& counts);
+    // puts new leaf right behind this one in the chain of leaves, or takes it out
+    void link(ExternalNodeClusterType* leaf);
+    void unlink();
+
+    CumFreqType     block_sums[Blocks];
+    // neighbouring leaves in order of elements, null_node at both ends
+    NodeIndex       prev;
+    NodeIndex       next;
+    std::uint8_t    width;      // bytes per count
+    // elements from the start, counts right behind capacity() elements
+    alignas(8) unsigned char storage[StorageSize];
 
     friend class InternalNodeCluster<Type, PageSize, FreqType, CumFreqType, overflow_check>;
     friend class RootNodeCluster<Type, PageSize, FreqType, CumFreqType, overflow_check>;
@@ -243,8 +417,26 @@ protected:
 };
 
 
+template<class Type>
+class FrozenCDFTree;
+
+// what CDFTree does when an insert would go over its memory limit
+enum class MemoryPolicy {
+    Reject,         // throw MemoryLimitError
+    Compact,        // repack elements into full leaves, then retry
+    Approximate     // merge elements into centroids (see CDFTree::compact), then retry
+};
+
 template<class Type>
 class CDFTree {
+    // elements are stored encoded, see key_traits.h
+    using Traits = KeyTraits<Type>;
+    using Key = typename Traits::Stored;
+    using RootNodeClusterType = RootNodeCluster<Key>;
+    using LeafType = typename RootNodeClusterType::ExternalNodeClusterType;
+    // budget and limit arithmetic uses pages of the clusters the tree is built of
+    static constexpr std::size_t PageSize = RootNodeClusterType::PageBytes;
+
 public:
     CDFTree();
 
@@ -254,37 +446,350 @@ public:
     // update
     double insert_sample(Type);
     double insert_sample(Type, unsigned i);
+    double remove_sample(Type, unsigned i = 1);
+    // batches use at most threads threads, 1 when the caller runs in parallel already
+    void insert_batch(const Type* samples, std::size_t size, unsigned threads = utils::thread_count());
+    void insert_batch(std::vector<Type> samples, unsigned threads = utils::thread_count());
     // element -> cummulative probability
     double search_CDF(Type e) const;
 
     // cummulative proabibility -> element
     Type inverse_search_CDF(double) const;
+    // batch versions, queries are sorted internally and results keep input order,
+    // large batches are split between at most threads threads
+    std::vector<double> search_CDF_batch(const Type* samples, std::size_t size,
+            unsigned threads = utils::thread_count()) const;
+    std::vector<Type> inverse_search_CDF_batch(const double* probabilities, std::size_t size,
+            unsigned threads = utils::thread_count()) const;
 
     Type minimal_element() const;
     Type maximal_element() const;
 
     void clear();
 
+    // bulk construction from unsorted samples
+    template<class Iterator>
+    static CDFTree build(Iterator begin, Iterator end);
+    static CDFTree build(std::vector<Type> samples);
+    // bulk construction from strictly increasing keys and their counts
+    static CDFTree from_sorted(const Type* keys, const unsigned* counts, std::size_t size);
+
+    // adds all samples of other tree, result is packed again
+    void merge(const CDFTree& other);
+    // packed tree with samples of all trees, equal keys are summed
+    static CDFTree merge(const std::vector<const CDFTree*>& trees);
+
+    // calls function(element, count) in increasing order
+    template<class Function>
+    void for_each(Function&& function) const {
+        root->for_each([&](Key key, unsigned count) { function(Traits::decode(key), count); });
+    }
+    // number of samples in [lo, hi]
+    unsigned long long range_count(Type lo, Type hi) const {
+        return root->range_count(Traits::encode(lo), Traits::encode(hi));
+    }
+    // distinct elements, export_to writes them sorted with their counts to arrays of that size
+    std::size_t distinct() const { return root->distinct(); }
+    void export_to(Type* elements, unsigned* counts) const;
+
+    // binary file, see cdf_tree_file.h for the format
+    void save(const std::string& path) const;
+    static CDFTree load(const std::string& path);
+
+    // immutable copy with faster queries, see frozen_cdf_tree.h
+    FrozenCDFTree<Type> freeze() const;
+
+    // shape of the tree, visits every cluster (not elements)
+    CDFTreeStats stats() const { return root->stats(); }
+
+    // Approximate mode. Whenever pages of the tree exceed the budget, runs of
+    // adjacent elements are merged into weighted centroids (weighted mean for
+    // floating point elements, weighted median otherwise) so that the packed
+    // tree takes about a quarter of the budget. No centroid gets more than
+    // 2/K of all samples, K being the number of elements fitting that quarter,
+    // and a compaction moves only samples of the run covering e to the other
+    // side of e, at most the weight of its heaviest centroid. A sample on the
+    // wrong side at the end was moved across e by some compaction, so the sum
+    // of these weights bounds the error of search_CDF (see rank_error).
+    // Merged elements can no longer be removed one by one. 0 means no budget.
+    void set_memory_budget(std::size_t bytes);
+    std::size_t memory_budget() const { return budget; }
+    // upper bound of |search_CDF(e) - exact CDF| while samples are only inserted:
+    // heaviest centroids of all compactions summed, over all samples; 0 until the
+    // first compaction
+    double rank_error() const;
+    // merges adjacent elements until at most about max_elements are left
+    void compact(std::size_t max_elements);
+
+    // Hard limit of bytes held by the tree, 0 means none. The process-wide limit
+    // of MemoryRegistry applies as well. Inserts reserve the pages they may need
+    // before changing anything, when that fails policy is applied and the
+    // reservation retried once. Approximate compacts the tree to about half of
+    // its limit. MemoryLimitError is thrown if the insert still does not fit,
+    // insert_batch keeps the elements inserted up to then.
+    void set_memory_limit(std::size_t bytes, MemoryPolicy policy = MemoryPolicy::Reject);
+    std::size_t memory_limit() const { return limit; }
+    MemoryPolicy memory_policy() const { return policy; }
+    // bytes of pages and page directories allocated for the tree
+    std::size_t memory_usage() const { return root->allocated_bytes(); }
+
 protected:
-    std::shared_ptr<RootNodeCluster<Type>> root;
+    void enforce_budget();
+    bool limited() const { return limit != 0 or MemoryRegistry::instance().limit() != 0; }
+    // threads for a batch query, small batches are not worth starting one
+    static unsigned batch_threads(std::size_t size, unsigned threads) {
+        constexpr std::size_t MinimalChunk = 1 << 14;
+        return static_cast<unsigned>(std::min<std::size_t>(threads, size / MinimalChunk + 1));
+    }
+    // reserves pages() pages (computed for the current root), applies policy if needed
+    template<class Pages>
+    void make_room(Pages&& pages);
+    // replaces root by packed tree of the given keys
+    void rebuild(const Key* keys, const unsigned* counts, std::size_t size);
+    static CDFTree from_keys(std::vector<Key> keys);
+    static CDFTree from_sorted_keys(const Key* keys, const unsigned* counts, std::size_t size);
+
+    std::shared_ptr<RootNodeClusterType> root;
     unsigned long long counter;
+    std::size_t         budget;
+    unsigned long long  centroid_weight;    // sum of heaviest centroids of all compactions
+    std::size_t         limit;
+    MemoryPolicy        policy;
 };
 
 template<class Type>
-CDFTree<Type>::CDFTree(){
+CDFTree<Type>::CDFTree() : budget(0), limit(0), policy(MemoryPolicy::Reject) {
     clear();
 }
 
 template<class Type>
 void CDFTree<Type>::clear() {
     counter = 0;
-    root = std::make_shared<RootNodeCluster<Type>>();
-    root->thisptr = root;
+    centroid_weight = 0;
+    rebuild(nullptr, nullptr, 0);
+}
+
+template<class Type>
+void CDFTree<Type>::rebuild(const Key* keys, const unsigned* counts, std::size_t size) {
+    root = RootNodeClusterType::factory();
+    root->set_memory_limit(limit);
+    if (size > 0)
+        root->bulk_load(keys, counts, size);
+}
+
+template<class Type>
+template<class Iterator>
+CDFTree<Type> CDFTree<Type>::build(Iterator begin, Iterator end) {
+    return build(std::vector<Type>(begin, end));
+}
+
+template<class Type>
+CDFTree<Type> CDFTree<Type>::build(std::vector<Type> samples) {
+    return from_keys(Traits::encode(std::move(samples)));
+}
+
+template<class Type>
+CDFTree<Type> CDFTree<Type>::from_keys(std::vector<Key> samples) {
+    utils::parallel_sort(samples.begin(), samples.end());
+
+    std::vector<Key> keys;
+    std::vector<unsigned> counts;
+    utils::aggregate_sorted(samples.data(), samples.size(), keys, counts);
+    samples = std::vector<Key>();
+
+    return from_sorted_keys(keys.data(), counts.data(), keys.size());
+}
+
+template<class Type>
+CDFTree<Type> CDFTree<Type>::from_sorted(const Type* elements, const unsigned* counts, std::size_t size) {
+    std::vector<Key> keys(size);
+    for (std::size_t i = 0; i < size; ++i)
+        keys[i] = Traits::encode(elements[i]);
+    return from_sorted_keys(keys.data(), counts, size);
+}
+
+template<class Type>
+CDFTree<Type> CDFTree<Type>::from_sorted_keys(const Key* keys, const unsigned* counts, std::size_t size) {
+    for (std::size_t i = 1; i < size; ++i)
+        if (not (keys[i-1] < keys[i]))
+            throw std::runtime_error("CDFTree::from_sorted requires strictly increasing keys");
+
+    CDFTree<Type> tree;
+    tree.root->bulk_load(keys, counts, size);
+    for (std::size_t i = 0; i < size; ++i)
+        tree.counter += counts[i];
+    return tree;
+}
+
+template<class Type>
+void CDFTree<Type>::merge(const CDFTree& other) {
+    std::size_t kept_budget = budget, kept_limit = limit;
+    MemoryPolicy kept_policy = policy;
+    *this = merge(std::vector<const CDFTree*>{this, &other});
+    budget = kept_budget;
+    limit = kept_limit;
+    policy = kept_policy;
+    root->set_memory_limit(limit);
+    enforce_budget();
+}
+
+template<class Type>
+CDFTree<Type> CDFTree<Type>::merge(const std::vector<const CDFTree*>& trees) {
+    std::size_t count = trees.size();
+    std::vector<std::vector<Key>> keys(count);
+    std::vector<std::vector<unsigned>> counts(count);
+    utils::parallel_for(count, [&](std::size_t first, std::size_t last) {
+        for (std::size_t t = first; t < last; ++t)
+            trees[t]->root->export_sorted(keys[t], counts[t]);
+    });
+
+    // k-way merge, heap holds the smallest unmerged key of every tree
+    using Head = std::pair<Key, std::size_t>;
+    auto greater = [](const Head& a, const Head& b) { return b.first < a.first; };
+    std::priority_queue<Head, std::vector<Head>, decltype(greater)> heap(greater);
+    std::vector<std::size_t> position(count, 0);
+    std::size_t total = 0;
+    for (std::size_t t = 0; t < count; ++t) {
+        total += keys[t].size();
+        if (not keys[t].empty())
+            heap.push({keys[t][0], t});
+    }
+
+    std::vector<Key> merged_keys;
+    std::vector<unsigned> merged_counts;
+    merged_keys.reserve(total);
+    merged_counts.reserve(total);
+    while (not heap.empty()) {
+        std::size_t t = heap.top().second;
+        heap.pop();
+        Key key = keys[t][position[t]];
+        if (not merged_keys.empty() and not (merged_keys.back() < key)) {
+            // same checks as insert_sample, counts of one key must stay representable
+            if (utils::sum_overflows(merged_counts.back(), counts[t][position[t]]))
+                throw std::runtime_error("merge: count of element overflows");
+            merged_counts.back() += counts[t][position[t]];
+        } else {
+            merged_keys.push_back(key);
+            merged_counts.push_back(counts[t][position[t]]);
+        }
+        if (++position[t] < keys[t].size())
+            heap.push({keys[t][position[t]], t});
+    }
+    CDFTree<Type> merged = from_sorted_keys(merged_keys.data(), merged_counts.data(), merged_keys.size());
+    // centroids of different trees may cover the same elements
+    for (const CDFTree* tree : trees)
+        merged.centroid_weight += tree->centroid_weight;
+    return merged;
+}
+
+template<class Type>
+void CDFTree<Type>::set_memory_budget(std::size_t bytes) {
+    if (bytes != 0 and bytes < 4 * PageSize)
+        throw std::runtime_error("CDFTree: memory budget has to be at least 4 pages");
+    budget = bytes;
+    enforce_budget();
+}
+
+template<class Type>
+inline void CDFTree<Type>::enforce_budget() {
+    if (budget != 0 and root->used_bytes() > budget) {
+        // packed tree takes about a quarter of the budget, splits of packed leaves
+        // have to double it twice before the next compaction;
+        // centroids carry large counts, leaves hold them in the widest counters
+        constexpr std::size_t leaf_capacity = LeafType::capacity_for(sizeof(unsigned)) - 1;
+        compact(budget / 4 / PageSize * leaf_capacity);
+    }
+}
+
+template<class Type>
+double CDFTree<Type>::rank_error() const {
+    return counter == 0 ? 0. : std::min(static_cast<double>(centroid_weight) / counter, 1.);
+}
+
+template<class Type>
+void CDFTree<Type>::compact(std::size_t max_elements) {
+    std::vector<Key> keys;
+    std::vector<unsigned> counts;
+    root->export_sorted(keys, counts);
+    if (keys.size() <= max_elements)
+        return;
+
+    // greedy runs, two neighbouring runs always weigh more than limit,
+    // so there are at most 2*counter/limit + 1 of them
+    unsigned long long limit = (2 * counter + max_elements - 1) / std::max<std::size_t>(max_elements, 1);
+    limit = std::min<unsigned long long>(std::max(limit, 1ull), std::numeric_limits<unsigned>::max());
+
+    // NaN is the greatest key of floating point elements, it is not averaged with numbers
+    std::size_t numbers = keys.size();
+    if constexpr (std::is_floating_point<Type>::value)
+        numbers -= keys.back() == Traits::encode(std::numeric_limits<Type>::quiet_NaN());
+
+    std::size_t size = 0;
+    unsigned long long heaviest = 0;
+    for (std::size_t first = 0; first < keys.size(); ) {
+        std::size_t last = first + 1;
+        unsigned long long weight = counts[first];
+        while (last < numbers and weight + counts[last] <= limit)
+            weight += counts[last++];
+
+        Key centroid = keys[first];
+        if (last - first > 1) {
+            if constexpr (std::is_floating_point<Type>::value) {
+                long double sum = 0;
+                for (std::size_t i = first; i < last; ++i)
+                    sum += static_cast<long double>(Traits::decode(keys[i])) * counts[i];
+                centroid = Traits::encode(static_cast<Type>(sum / weight));
+                centroid = std::min(std::max(centroid, keys[first]), keys[last - 1]);
+            } else {
+                unsigned long long below = 0;
+                std::size_t median = first;
+                while (2 * (below + counts[median]) < weight)
+                    below += counts[median++];
+                centroid = keys[median];
+            }
+            heaviest = std::max(heaviest, weight);
+        }
+        keys[size] = centroid;
+        counts[size] = static_cast<unsigned>(weight);
+        ++size;
+        first = last;
+    }
+    // errors of successive compactions add up
+    centroid_weight += heaviest;
+
+    rebuild(keys.data(), counts.data(), size);
+}
+
+template<class Type>
+void CDFTree<Type>::set_memory_limit(std::size_t bytes, MemoryPolicy memory_policy) {
+    limit = bytes;
+    policy = memory_policy;
+    root->set_memory_limit(limit);
+}
+
+template<class Type>
+template<class Pages>
+void CDFTree<Type>::make_room(Pages&& pages) {
+    if (root->reserve(pages()))
+        return;
+    if (policy == MemoryPolicy::Compact and root->stats().leaf_fill < 0.9) {
+        std::vector<Key> elements;
+        std::vector<unsigned> counts;
+        root->export_sorted(elements, counts);
+        rebuild(elements.data(), counts.data(), elements.size());
+    } else if (policy == MemoryPolicy::Approximate) {
+        constexpr std::size_t leaf_capacity = LeafType::capacity_for(sizeof(unsigned)) - 1;
+        std::size_t bytes = limit != 0 ? limit : memory_usage();
+        compact(bytes / 2 / PageSize * leaf_capacity);
+    } else
+        throw MemoryLimitError("CDFTree: insert would exceed memory limit");
+    if (not root->reserve(pages()))
+        throw MemoryLimitError("CDFTree: insert would exceed memory limit");
 }
 
 template<class Type>
 inline unsigned CDFTree<Type>::search_count(Type e) const {
-    return root->search_PDF(e);
+    return root->search_PDF(Traits::encode(e));
 }
 template<class Type>
 inline double CDFTree<Type>::search_PDF(Type e) const {
@@ -293,19 +798,76 @@ inline double CDFTree<Type>::search_PDF(Type e) const {
 }
 template<class Type>
 inline double CDFTree<Type>::insert_sample(Type e) {
-    unsigned long long s = root->insert_sample(e);
-    counter += 1;
-    return static_cast<double>(s) / counter;
+    return insert_sample(e, 1);
 }
 template<class Type>
 inline double CDFTree<Type>::insert_sample(Type e, unsigned i) {
-    unsigned long long s = root->insert_sample(e, i);
+    Key key = Traits::encode(e);
+    if (limited())
+        make_room([&] { return root->pages_for_insert(key, i); });
+    unsigned long long s = root->insert_sample(key, i);
     counter += i;
+    enforce_budget();
     return static_cast<double>(s) / counter;
 }
+template<class Type>
+inline double CDFTree<Type>::remove_sample(Type e, unsigned i) {
+    unsigned long long s = root->remove_sample(Traits::encode(e), i);
+    counter -= i;
+    return counter == 0 ? 0. : static_cast<double>(s) / counter;
+}
+template<class Type>
+void CDFTree<Type>::insert_batch(const Type* samples, std::size_t size, unsigned threads) {
+    insert_batch(std::vector<Type>(samples, samples + size), threads);
+}
+template<class Type>
+void CDFTree<Type>::insert_batch(std::vector<Type> elements, unsigned threads) {
+    std::vector<Key> samples = Traits::encode(std::move(elements));
+    utils::parallel_sort(samples.begin(), samples.end(), std::less<>(), threads);
+
+    std::vector<Key> keys;
+    std::vector<unsigned> counts;
+    utils::aggregate_sorted(samples.data(), samples.size(), keys, counts);
+
+    // under a memory limit keys go in chunks whose pages are reserved first,
+    // one by one once a chunk does not fit
+    std::size_t chunk = limited() ? 64 : keys.size();
+    for (std::size_t begin = 0; begin < keys.size(); ) {
+        std::size_t size = std::min(chunk, keys.size() - begin);
+        if (limited()) {
+            if (size > 1 and not root->reserve(root->pages_for_insert(size))) {
+                chunk = 1;
+                continue;
+            }
+            if (size == 1)
+                make_room([&] { return root->pages_for_insert(keys[begin], counts[begin]); });
+        }
+        try {
+            root->insert_sorted(keys.data() + begin, counts.data() + begin, size);
+        } catch (...) {
+            // runs before an overflowing count are already inserted
+            counter = root->total();
+            throw;
+        }
+        counter = root->total();
+        begin += size;
+    }
+    enforce_budget();
+}
+template<class Type>
+void CDFTree<Type>::export_to(Type* elements, unsigned* counts) const {
+    // leaves are copied whole, keys decoded in place
+    root->for_each_leaf([&](const Key* keys, auto leaf_counts, unsigned size) {
+        for (unsigned i = 0; i < size; ++i)
+            elements[i] = Traits::decode(keys[i]);
+        counts = std::copy(leaf_counts, leaf_counts + size, counts);
+        elements += size;
+    });
+}
+
 template<class Type>
 inline double CDFTree<Type>::search_CDF(Type e) const {
-    unsigned long long s = root->search_CDF(e);
+    unsigned long long s = root->search_CDF(Traits::encode(e));
     return static_cast<double>(s) / counter;
 }
 
@@ -316,19 +878,73 @@ inline Type CDFTree<Type>::inverse_search_CDF(double e) const {
         throw std::runtime_error("Inversion of CDF=0 is impossible to obtain");
     }
     assert(b <= counter);
-    return root->inverse_search_CDF(b);
+    return Traits::decode(root->inverse_search_CDF(b));
 }
+template<class Type>
+std::vector<double> CDFTree<Type>::search_CDF_batch(const Type* samples, std::size_t size, unsigned threads) const {
+    std::vector<std::pair<Key, std::size_t>> queries(size);
+    for (std::size_t i = 0; i < size; ++i)
+        queries[i] = {Traits::encode(samples[i]), i};
+    utils::parallel_sort(queries.begin(), queries.end(), std::less<>(), threads);
+
+    // sorted runs are searched concurrently, each one visits its leaves once
+    std::vector<double> result(size);
+    utils::parallel_for(size, [&](std::size_t first, std::size_t last) {
+        std::vector<Key> keys(last - first);
+        for (std::size_t i = first; i < last; ++i)
+            keys[i - first] = queries[i].first;
+        std::vector<unsigned long long> sums(last - first);
+        root->search_CDF_sorted(keys.data(), keys.size(), sums.data());
+        for (std::size_t i = first; i < last; ++i)
+            result[queries[i].second] = static_cast<double>(sums[i - first]) / counter;
+    }, batch_threads(size, threads));
+    return result;
+}
+
+template<class Type>
+std::vector<Type> CDFTree<Type>::inverse_search_CDF_batch(const double* probabilities, std::size_t size, unsigned threads) const {
+    // all queries are checked here, workers must not fail on bad input
+    std::vector<std::pair<unsigned long long, std::size_t>> queries(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        double p = probabilities[i];
+        if (not (p > 0. and p <= 1.)) {
+            throw std::runtime_error("Only CDF in (0, 1] can be inverted");
+        }
+        unsigned long long b = static_cast<unsigned long long>(std::ceil(p*counter));
+        if (b <= 0) {
+            throw std::runtime_error("Inversion of CDF=0 is impossible to obtain");
+        }
+        // p*counter may round past counter for p close to 1
+        queries[i] = {std::min(b, counter), i};
+    }
+    utils::parallel_sort(queries.begin(), queries.end(), std::less<>(), threads);
+
+    std::vector<Type> result(size);
+    utils::parallel_for(size, [&](std::size_t first, std::size_t last) {
+        std::vector<unsigned long long> sums(last - first);
+        for (std::size_t i = first; i < last; ++i)
+            sums[i - first] = queries[i].first;
+        std::vector<Key> elements(last - first);
+        root->inverse_search_CDF_sorted(sums.data(), sums.size(), elements.data());
+        for (std::size_t i = first; i < last; ++i)
+            result[queries[i].second] = Traits::decode(elements[i - first]);
+    }, batch_threads(size, threads));
+    return result;
+}
+
 template<class Type>
 inline Type CDFTree<Type>::minimal_element() const {
-    return root->minimal_element();
+    return Traits::decode(root->minimal_element());
 }
 template<class Type>
 inline Type CDFTree<Type>::maximal_element() const {
-    return root->maximal_element();
+    return Traits::decode(root->maximal_element());
 }
 
 #include "cdf_tree_implementation.h"
 #include "cdf_tree_print_and_debug.h"
+#include "cdf_tree_file.h"
+#include "frozen_cdf_tree.h"
 
 
 #endif // INCLUDED_CDF_TREE_MAIN
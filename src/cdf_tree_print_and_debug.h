@@ -11,31 +11,31 @@ template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool
 std::ostream& operator<< (std::ostream& s, const RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>& item) {
     s << "Root Node [" << &item << "] size: " << item.size << "\n";
     for (unsigned i = 0; i < item.size; ++i) {
-        s << "["<< item.children[i].get() << "]" << item.data[i];
+        s << "["<< item.children[i] << "]" << item.data[i];
     }
-    s << "[" << item.children[item.size].get() << "]\n";
+    s << "[" << item.children[item.size] << "]\n";
     return s;
 }
 
 // INTERNAL NODE CLUSTER
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
 std::ostream& operator<< (std::ostream& s, const InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>& item) {
-    s << "Internal Node [" << item.thisptr.lock() 
-        << "] parent: [" << item.parent.lock() << "] size: " << item.size << "\n";
+    s << "Internal Node [" << item.thisptr 
+        << "] parent: [" << item.parent << "] size: " << item.size << "\n";
     for (unsigned i = 0; i < item.size; ++i) {
-        s << "["<< item.children[i].get() << "]" << item.data[i];
+        s << "["<< item.children[i] << "]" << item.data[i];
     }
-    s << "[" << item.children[item.size].get() << "]\n";
+    s << "[" << item.children[item.size] << "]\n";
     return s;
 }
 
 // EXTERNAL NODE CLUSTER
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
 std::ostream& operator<< (std::ostream& s, const ExternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>& item) {
-    s << "External Node [" << &item << "] parent: [" << item.parent.lock()
+    s << "External Node [" << &item << "] parent: [" << item.parent
        <<  "] size: " << item.size << "\n";
     for (unsigned i = 0; i < item.size; ++i) {
-        s << item.data[i] << " ";
+        s << item.data()[i] << " ";
     }
     s << '\n';
     return s;
@@ -72,9 +72,9 @@ template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool
 void RootNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::print(unsigned g) const {
     std::cout << *this;
 
-    if (children[0])
+    if (children[0] != null_node)
     for (unsigned i = 0; i < size + 1; ++i)
-        children[i]->print(g+1);
+        visit_child(children[i], [g](auto child) { child->print(g+1); });
 }
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
@@ -84,7 +84,7 @@ void InternalNodeCluster<Type,PageSize,FreqType,CumFreqType,overflow_check>::pri
     std::cout << add_tab_after_new_newline(s.str(), g);
 
     for (unsigned i = 0; i < size + 1; ++i)
-        children[i]->print(g+1);
+        this->visit_child(children[i], [g](auto child) { child->print(g+1); });
 }
 
 template<class Type, unsigned PageSize, class FreqType, class CumFreqType, bool overflow_check>
@@ -0,0 +1,126 @@
+#if not defined INCLUDED_DECAYED_CDF_TREE
+#define INCLUDED_DECAYED_CDF_TREE
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+#include "cdf_tree_main.h"
+
+
+template<class Type>
+class DecayedCDFTree {
+    // Every insert multiplies weight of all older samples by decay. Instead of
+    // touching the whole tree, new samples get weight growing by 1/decay and
+    // the tree is renormalized only when the weight gets close to overflow.
+public:
+    explicit DecayedCDFTree(double decay);
+
+    // element -> probability
+    double search_PDF(Type) const;
+    // update
+    double insert_sample(Type);
+    // element -> cummulative probability
+    double search_CDF(Type e) const;
+    // cummulative proabibility -> element
+    Type inverse_search_CDF(double) const;
+
+    Type minimal_element() const;
+    Type maximal_element() const;
+
+    // sum of decayed weights, the newest sample has weight 1
+    double total_weight() const { return total / (weight * decay); }
+
+    void clear();
+
+protected:
+    // elements are stored encoded as in CDFTree, see key_traits.h
+    using Traits = KeyTraits<Type>;
+    using Key = typename Traits::Stored;
+    using RootNodeClusterType = RootNodeCluster<Key, 4096, double, double>;
+
+    // renormalization point, leaves plenty of room for total of the weights
+    static constexpr double MaxWeight = 1e200;
+    // samples below this weight (relative to the newest one) are forgotten on renormalization
+    static constexpr double NegligibleWeight = 1e-20;
+
+    void renormalize();
+
+    std::shared_ptr<RootNodeClusterType> root;
+    double  decay;
+    double  weight;     // weight of the next inserted sample
+    double  total;      // sum of weights stored in the tree
+};
+
+
+template<class Type>
+DecayedCDFTree<Type>::DecayedCDFTree(double decay) : decay(decay) {
+    if (not (decay > 0. and decay <= 1.))
+        throw std::runtime_error("DecayedCDFTree: decay has to be in (0, 1]");
+    clear();
+}
+
+template<class Type>
+void DecayedCDFTree<Type>::clear() {
+    root = RootNodeClusterType::factory();
+    weight = 1.;
+    total = 0.;
+}
+
+template<class Type>
+void DecayedCDFTree<Type>::renormalize() {
+    // O(n), happens once per log(MaxWeight)/log(1/decay) inserts
+    double factor = 1. / weight;
+    std::vector<std::pair<Key, double>> negligible;
+    root->scale(factor, NegligibleWeight, negligible);
+    total *= factor;
+    weight = 1.;
+
+    for (auto& p : negligible) {
+        root->remove_sample(p.first, p.second);
+        total -= p.second;
+    }
+    total = std::max(total, 0.);
+}
+
+template<class Type>
+inline double DecayedCDFTree<Type>::insert_sample(Type e) {
+    double s = root->insert_sample(Traits::encode(e), weight);
+    total += weight;
+    double pdf = s / total;
+
+    weight /= decay;
+    if (weight > MaxWeight)
+        renormalize();
+    return pdf;
+}
+
+template<class Type>
+inline double DecayedCDFTree<Type>::search_PDF(Type e) const {
+    return total > 0. ? root->search_PDF(Traits::encode(e)) / total : 0.;
+}
+template<class Type>
+inline double DecayedCDFTree<Type>::search_CDF(Type e) const {
+    return total > 0. ? std::min(root->search_CDF(Traits::encode(e)) / total, 1.) : 0.;
+}
+template<class Type>
+inline Type DecayedCDFTree<Type>::inverse_search_CDF(double e) const {
+    double b = e * total;
+    if (b <= 0.) {
+        throw std::runtime_error("Inversion of CDF=0 is impossible to obtain");
+    }
+    return Traits::decode(root->inverse_search_CDF(b));
+}
+template<class Type>
+inline Type DecayedCDFTree<Type>::minimal_element() const {
+    return Traits::decode(root->minimal_element());
+}
+template<class Type>
+inline Type DecayedCDFTree<Type>::maximal_element() const {
+    return Traits::decode(root->maximal_element());
+}
+
+#endif // INCLUDED_DECAYED_CDF_TREE
@@ -0,0 +1,183 @@
+#if not defined INCLUDED_FROZEN_CDF_TREE
+#define INCLUDED_FROZEN_CDF_TREE
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <stdexcept>
+
+#include "cdf_tree_main.h"
+
+
+template<class Type>
+class FrozenCDFTree {
+    // Immutable copy of a CDFTree for query-only workloads. Elements are stored
+    // in Eytzinger order (children of k are 2k and 2k+1, position 0 is unused),
+    // so binary search walks down an implicit tree without pointers and the
+    // first levels stay in cache. Inclusive cumulative counts are kept in the
+    // same order and searched the same way for the inverse CDF. Elements are
+    // encoded like in CDFTree, see key_traits.h.
+    using Traits = KeyTraits<Type>;
+    using Key = typename Traits::Stored;
+
+public:
+    FrozenCDFTree() : total(0) {}
+    // keys strictly increasing
+    FrozenCDFTree(const Type* keys, const unsigned* counts, std::size_t size);
+
+    // element -> probability
+    double search_PDF(Type) const;
+    unsigned search_count(Type) const;
+    // element -> cummulative probability
+    double search_CDF(Type e) const;
+    // cummulative proabibility -> element
+    Type inverse_search_CDF(double) const;
+    std::vector<double> search_CDF_batch(const Type* samples, std::size_t size) const;
+    std::vector<Type> inverse_search_CDF_batch(const double* probabilities, std::size_t size) const;
+
+    Type minimal_element() const;
+    Type maximal_element() const;
+
+    // number of samples
+    unsigned long long size() const { return total; }
+
+protected:
+    // Eytzinger position of the first element for which goes_right is false, 0 if none
+    template<class Array, class Value>
+    std::size_t descend(const Array& array, Value value, bool inclusive) const;
+    std::size_t fill(const Type* keys, const unsigned* counts, std::size_t i, std::size_t k,
+                     std::uint64_t& cumulative);
+    unsigned long long search_CDF_count(Type e) const;
+
+    std::vector<Key>            elements;
+    std::vector<unsigned>       counts;
+    std::vector<std::uint64_t>  cumulative;     // samples lower or equal to the element
+    unsigned long long          total;
+};
+
+
+template<class Type>
+FrozenCDFTree<Type>::FrozenCDFTree(const Type* keys, const unsigned* key_counts, std::size_t size)
+    : elements(size + 1), counts(size + 1), cumulative(size + 1), total(0)
+{
+    std::uint64_t sum = 0;
+    fill(keys, key_counts, 0, 1, sum);
+    total = sum;
+}
+
+template<class Type>
+std::size_t FrozenCDFTree<Type>::fill(const Type* keys, const unsigned* key_counts, std::size_t i, std::size_t k,
+                                      std::uint64_t& sum) {
+    // in-order walk of the implicit tree visits positions in increasing key order
+    if (k < elements.size()) {
+        i = fill(keys, key_counts, i, 2*k, sum);
+        sum += key_counts[i];
+        elements[k] = Traits::encode(keys[i]);
+        counts[k] = key_counts[i];
+        cumulative[k] = sum;
+        i = fill(keys, key_counts, i + 1, 2*k + 1, sum);
+    }
+    return i;
+}
+
+template<class Type>
+template<class Array, class Value>
+inline std::size_t FrozenCDFTree<Type>::descend(const Array& array, Value value, bool inclusive) const {
+    // goes right while array[k] < value (or <= value when inclusive), the final
+    // position encodes the path, right turns after the last left one are dropped
+    // descendants few levels below k share one cache line, it is fetched ahead
+    constexpr std::size_t Line = 64 / sizeof(Value);
+    std::size_t n = array.size();
+    std::size_t k = 1;
+    while (k < n) {
+        __builtin_prefetch(array.data() + std::min(Line*k, n - 1));
+        k = 2*k + (inclusive ? not (value < array[k]) : array[k] < value);
+    }
+    k >>= __builtin_ffsll(~k);
+    return k;
+}
+
+template<class Type>
+inline unsigned long long FrozenCDFTree<Type>::search_CDF_count(Type e) const {
+    std::size_t k = descend(elements, Traits::encode(e), true);
+    return k == 0 ? total : cumulative[k] - counts[k];
+}
+
+template<class Type>
+inline unsigned FrozenCDFTree<Type>::search_count(Type e) const {
+    Key key = Traits::encode(e);
+    std::size_t k = descend(elements, key, false);
+    return k == 0 or key < elements[k] ? 0 : counts[k];
+}
+template<class Type>
+inline double FrozenCDFTree<Type>::search_PDF(Type e) const {
+    return static_cast<double>(search_count(e)) / total;
+}
+template<class Type>
+inline double FrozenCDFTree<Type>::search_CDF(Type e) const {
+    return static_cast<double>(search_CDF_count(e)) / total;
+}
+
+template<class Type>
+inline Type FrozenCDFTree<Type>::inverse_search_CDF(double e) const {
+    unsigned long long b = static_cast<unsigned long long>(std::ceil(e*total));
+    if (b <= 0) {
+        throw std::runtime_error("Inversion of CDF=0 is impossible to obtain");
+    }
+    std::size_t k = descend(cumulative, static_cast<std::uint64_t>(b), false);
+    if (k == 0)
+        throw std::runtime_error("Inverse search failed");
+    return Traits::decode(elements[k]);
+}
+
+template<class Type>
+std::vector<double> FrozenCDFTree<Type>::search_CDF_batch(const Type* samples, std::size_t size) const {
+    // no sorting needed, independent descents overlap their cache misses
+    std::vector<double> result(size);
+    for (std::size_t i = 0; i < size; ++i)
+        result[i] = search_CDF(samples[i]);
+    return result;
+}
+
+template<class Type>
+std::vector<Type> FrozenCDFTree<Type>::inverse_search_CDF_batch(const double* probabilities, std::size_t size) const {
+    std::vector<Type> result(size);
+    for (std::size_t i = 0; i < size; ++i)
+        result[i] = inverse_search_CDF(probabilities[i]);
+    return result;
+}
+
+template<class Type>
+Type FrozenCDFTree<Type>::minimal_element() const {
+    if (elements.size() <= 1)
+        throw std::runtime_error("Mininal Element on empty tree");
+    std::size_t k = 1;
+    while (2*k < elements.size())
+        k = 2*k;
+    return Traits::decode(elements[k]);
+}
+
+template<class Type>
+Type FrozenCDFTree<Type>::maximal_element() const {
+    if (elements.size() <= 1)
+        throw std::runtime_error("Maximal Element on empty tree");
+    std::size_t k = 1;
+    while (2*k + 1 < elements.size())
+        k = 2*k + 1;
+    return Traits::decode(elements[k]);
+}
+
+
+template<class Type>
+FrozenCDFTree<Type> CDFTree<Type>::freeze() const {
+    std::vector<Key> keys;
+    std::vector<unsigned> key_counts;
+    root->export_sorted(keys, key_counts);
+    std::vector<Type> elements(keys.size());
+    for (std::size_t i = 0; i < keys.size(); ++i)
+        elements[i] = Traits::decode(keys[i]);
+    return FrozenCDFTree<Type>(elements.data(), key_counts.data(), elements.size());
+}
+
+#endif // INCLUDED_FROZEN_CDF_TREE
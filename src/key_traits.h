@@ -0,0 +1,66 @@
+#if not defined INCLUDED_KEY_TRAITS
+#define INCLUDED_KEY_TRAITS
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include <utility>
+
+///////////////////////// KEY TRAITS /////////////////////////
+// Elements are stored in clusters as Stored keys. encode is strictly
+// monotonic, so keys compare like the elements they come from, and
+// decode(encode(e)) gives e back. Element types without a specialization
+// are stored as they are.
+template<class Type>
+struct KeyTraits {
+    using Stored = Type;
+
+    static Stored encode(Type e) { return e; }
+    static Type decode(Stored key) { return key; }
+    static std::vector<Stored> encode(std::vector<Type>&& elements) { return std::move(elements); }
+};
+
+// Floating point elements become unsigned integers of the same size, the
+// sign bit is flipped for positive values and all bits for negative ones.
+// -0.0 is stored as +0.0 and every NaN as one canonical NaN above +inf,
+// so integer comparisons give a total order and SIMD kernels for integers
+// apply.
+template<class Float, class Bits>
+struct FloatingKeyTraits {
+    using Stored = Bits;
+    static_assert(sizeof(Float) == sizeof(Bits), "floating point element and its key differ in size");
+
+    static constexpr Bits Sign = Bits(1) << (sizeof(Bits) * 8 - 1);
+    static constexpr Bits NaN = std::numeric_limits<Bits>::max();
+
+    static Stored encode(Float e) {
+        if (e != e)
+            return NaN;
+        e = e == Float(0) ? Float(0) : e;
+        Bits bits;
+        std::memcpy(&bits, &e, sizeof(bits));
+        return bits & Sign ? ~bits : bits | Sign;
+    }
+    static Float decode(Stored key) {
+        Bits bits = key & Sign ? key & ~Sign : ~key;
+        Float e;
+        std::memcpy(&e, &bits, sizeof(e));
+        return e;
+    }
+    static std::vector<Stored> encode(std::vector<Float>&& elements) {
+        std::vector<Stored> keys(elements.size());
+        for (std::size_t i = 0; i < elements.size(); ++i)
+            keys[i] = encode(elements[i]);
+        elements = std::vector<Float>();
+        return keys;
+    }
+};
+
+template<>
+struct KeyTraits<float> : FloatingKeyTraits<float, std::uint32_t> {};
+
+template<>
+struct KeyTraits<double> : FloatingKeyTraits<double, std::uint64_t> {};
+
+#endif // INCLUDED_KEY_TRAITS
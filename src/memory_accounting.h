@@ -0,0 +1,58 @@
+#if not defined INCLUDED_MEMORY_ACCOUNTING
+#define INCLUDED_MEMORY_ACCOUNTING
+
+#include <atomic>
+#include <cstddef>
+#include <stdexcept>
+
+
+// thrown instead of growing a tree over its own or the process-wide limit,
+// the tree is left as it was before the failing insert
+class MemoryLimitError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+
+class MemoryRegistry {
+    // Bytes held by arenas of all trees in the process. Only growth that may be
+    // refused (NodeArena::reserve) checks the limit, pages needed by a structural
+    // change already in progress are always accounted and handed out.
+public:
+    static MemoryRegistry& instance() {
+        static MemoryRegistry registry;
+        return registry;
+    }
+
+    std::size_t allocated() const { return bytes.load(std::memory_order_relaxed); }
+    // number of live arenas (trees)
+    std::size_t arenas() const { return arena_count.load(std::memory_order_relaxed); }
+    // 0 means no limit
+    std::size_t limit() const { return max_bytes.load(std::memory_order_relaxed); }
+    void set_limit(std::size_t bytes) { max_bytes.store(bytes, std::memory_order_relaxed); }
+
+    // accounts size bytes only if they fit under the limit
+    bool try_acquire(std::size_t size) {
+        std::size_t current = bytes.load(std::memory_order_relaxed);
+        do {
+            std::size_t max = limit();
+            if (max != 0 and current + size > max)
+                return false;
+        } while (not bytes.compare_exchange_weak(current, current + size, std::memory_order_relaxed));
+        return true;
+    }
+    void acquire(std::size_t size) { bytes.fetch_add(size, std::memory_order_relaxed); }
+    void release(std::size_t size) { bytes.fetch_sub(size, std::memory_order_relaxed); }
+
+    void register_arena() { arena_count.fetch_add(1, std::memory_order_relaxed); }
+    void unregister_arena() { arena_count.fetch_sub(1, std::memory_order_relaxed); }
+
+private:
+    MemoryRegistry() : bytes(0), max_bytes(0), arena_count(0) {}
+
+    std::atomic<std::size_t> bytes;
+    std::atomic<std::size_t> max_bytes;
+    std::atomic<std::size_t> arena_count;
+};
+
+#endif // INCLUDED_MEMORY_ACCOUNTING
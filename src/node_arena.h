@@ -0,0 +1,199 @@
+#if not defined INCLUDED_NODE_ARENA
+#define INCLUDED_NODE_ARENA
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <new>
+#include <vector>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <boost/assert.hpp>
+
+#include "memory_accounting.h"
+
+// compact link between node clusters (index of page inside of the tree's arena)
+using NodeIndex = std::uint32_t;
+constexpr NodeIndex null_node = std::numeric_limits<NodeIndex>::max();
+
+
+template<unsigned PageSize>
+class NodeArena {
+    // Hands out PageSize aligned pages. Pages are allocated in blocks that grow
+    // geometrically (1, 2, 4, ..., MaxBlockPages pages) so small trees stay small,
+    // blocks are never moved so pointers into pages stay valid.
+    // Only one thread may allocate, but at() is safe from other threads for
+    // pages published to them: outgrown block directories are kept alive.
+    // Blocks and directories are accounted in MemoryRegistry.
+    static_assert((PageSize & (PageSize - 1)) == 0, "PageSize has to be power of two");
+    static_assert(PageSize >= sizeof(void*), "PageSize is too small");
+
+public:
+    NodeArena();
+    ~NodeArena();
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    // allocates page and constructs T inside of it
+    template<class T, class... Args>
+    NodeIndex create(Args&&... args);
+    // returns page back (T has to be trivially destructible)
+    void release(NodeIndex);
+    // makes sure next count pages are created without growing, returns false
+    // (and grows no further) if that would exceed limit or the process-wide limit
+    bool reserve(NodeIndex count);
+
+    template<class T>
+    T* at(NodeIndex index) const {
+        BOOST_ASSERT(index < pages.load(std::memory_order_relaxed));
+        return reinterpret_cast<T*>(page(index));
+    }
+
+    // number of pages in use
+    unsigned used_pages() const { return pages.load(std::memory_order_relaxed) - free_pages.size(); }
+    // bytes obtained from the system
+    std::size_t reserved_bytes() const { return std::size_t(capacity) * PageSize; }
+    // bytes of blocks and directories
+    std::size_t allocated_bytes() const { return allocated; }
+    // bytes reserve may not go over, 0 means no limit
+    std::size_t limit;
+
+    // structural changes of the tree living in the arena, kept for statistics
+    struct Counters {
+        unsigned long long leaf_splits = 0;
+        unsigned long long internal_splits = 0;     // root included
+        unsigned long long merges = 0;              // clusters merged into a neighbour
+    };
+    Counters counters;
+
+private:
+    static constexpr unsigned  GrowthSteps = 8;
+    static constexpr NodeIndex MaxBlockPages = NodeIndex(1) << GrowthSteps;
+    static constexpr NodeIndex GeometricPages = (NodeIndex(1) << (GrowthSteps + 1)) - 1;
+
+    static NodeIndex block_pages(unsigned block) {
+        return block <= GrowthSteps ? NodeIndex(1) << block : MaxBlockPages;
+    }
+
+    char* page(NodeIndex index) const {
+        char* const* blocks = directory.load(std::memory_order_acquire);
+        if (index < GeometricPages) {
+            unsigned block = 31 - __builtin_clz(index + 1);
+            return blocks[block] + std::size_t(index + 1 - (NodeIndex(1) << block)) * PageSize;
+        }
+        index -= GeometricPages;
+        return blocks[GrowthSteps + 1 + index / MaxBlockPages] + std::size_t(index % MaxBlockPages) * PageSize;
+    }
+
+    // returns false without growing if enforced and the limits would be exceeded
+    bool grow(bool enforced = false);
+
+    std::atomic<char**>                     directory;      // pointers to blocks
+    std::vector<std::unique_ptr<char*[]>>   directories;    // current one is the last
+    unsigned                                block_count;
+    unsigned                                directory_size;
+    std::vector<NodeIndex>                  free_pages;
+    std::atomic<NodeIndex>                  pages;          // pages handed out so far
+    NodeIndex                               capacity;       // pages in allocated blocks
+    std::size_t                             allocated;      // bytes of blocks and directories
+};
+
+
+template<unsigned PageSize>
+NodeArena<PageSize>::NodeArena() 
+    : limit(0), directory(nullptr), block_count(0), directory_size(0), pages(0), capacity(0), allocated(0)
+{
+    MemoryRegistry::instance().register_arena();
+}
+
+template<unsigned PageSize>
+NodeArena<PageSize>::~NodeArena() {
+    char** blocks = directory.load(std::memory_order_relaxed);
+    for (unsigned i = 0; i < block_count; ++i)
+        std::free(blocks[i]);
+    MemoryRegistry::instance().release(allocated);
+    MemoryRegistry::instance().unregister_arena();
+}
+
+template<unsigned PageSize>
+bool NodeArena<PageSize>::grow(bool enforced) {
+    NodeIndex count = block_pages(block_count);
+    if (capacity > null_node - count)
+        throw std::runtime_error("NodeArena: too many pages");
+
+    std::size_t bytes = std::size_t(count) * PageSize;
+    if (block_count == directory_size)
+        bytes += (directory_size == 0 ? 16 : 2 * directory_size) * sizeof(char*);
+    if (not enforced)
+        MemoryRegistry::instance().acquire(bytes);
+    else if ((limit != 0 and allocated + bytes > limit) or not MemoryRegistry::instance().try_acquire(bytes))
+        return false;
+
+    // bytes stay accounted only if all allocations succeed
+    void* block = nullptr;
+    try {
+        block = std::aligned_alloc(PageSize, std::size_t(count) * PageSize);
+        if (block == nullptr)
+            throw std::bad_alloc();
+        if (block_count == directory_size) {
+            // readers may still use the old directory, it is only replaced
+            unsigned size = directory_size == 0 ? 16 : 2 * directory_size;
+            std::unique_ptr<char*[]> bigger(new char*[size]);
+            if (block_count > 0)
+                std::copy(directories.back().get(), directories.back().get() + block_count, bigger.get());
+            directories.push_back(std::move(bigger));
+            directory_size = size;
+            directory.store(directories.back().get(), std::memory_order_release);
+        }
+    } catch (...) {
+        std::free(block);
+        MemoryRegistry::instance().release(bytes);
+        throw;
+    }
+    allocated += bytes;
+    directories.back()[block_count++] = static_cast<char*>(block);
+    capacity += count;
+    return true;
+}
+
+template<unsigned PageSize>
+bool NodeArena<PageSize>::reserve(NodeIndex count) {
+    while (free_pages.size() + (capacity - pages.load(std::memory_order_relaxed)) < count)
+        if (not grow(true))
+            return false;
+    return true;
+}
+
+template<unsigned PageSize>
+template<class T, class... Args>
+NodeIndex NodeArena<PageSize>::create(Args&&... args) {
+    static_assert(sizeof(T) <= PageSize, "Page size overflow");
+    static_assert(alignof(T) <= PageSize, "Page alignment is insufficient");
+    static_assert(std::is_trivially_destructible<T>::value, "Arena does not call destructors");
+
+    NodeIndex index;
+    if (not free_pages.empty()) {
+        index = free_pages.back();
+        free_pages.pop_back();
+    } else {
+        index = pages.load(std::memory_order_relaxed);
+        if (index == capacity)
+            grow();
+        pages.store(index + 1, std::memory_order_relaxed);
+    }
+    new (page(index)) T(std::forward<Args>(args)...);
+    return index;
+}
+
+template<unsigned PageSize>
+void NodeArena<PageSize>::release(NodeIndex index) {
+    BOOST_ASSERT(index < pages.load(std::memory_order_relaxed));
+    free_pages.push_back(index);
+}
+
+#endif // INCLUDED_NODE_ARENA
@@ -1,7 +1,16 @@
 #include <iostream>
+#include <limits>
 #include <cstdint>
 #include <cassert>
 #include <vector>
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <new>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
 
 #define PY_SSIZE_T_CLEAN
 #define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
@@ -14,10 +23,591 @@
 
 #include "cdf_tree_main.h"
 
-static std::vector<CDFTree<float>>* all_data = nullptr;
+// Calls run their loops without the GIL, every tree has its own lock, so
+// different trees are updated concurrently. Trees are either Tree objects or
+// entries of the list used by module functions taking an index. The list is
+// only changed and looked into while the GIL is held, its entries are shared,
+// a call keeps its tree alive even if free_memory runs meanwhile.
+struct TreeEntry {
+    std::shared_mutex mutex;
+    CDFTree<float> tree;
+};
+using ReadLock = std::shared_lock<std::shared_mutex>;
+using WriteLock = std::unique_lock<std::shared_mutex>;
+
+static std::vector<std::shared_ptr<TreeEntry>>* all_data = nullptr;
+
+// tree at index, created if it does not exist yet (GIL held)
+static std::shared_ptr<TreeEntry> tree_at(int index) {
+    std::size_t size = all_data->size();
+    if (size <= static_cast<unsigned>(index)) {
+        all_data->resize(index+1);
+        for (std::size_t i = size; i < all_data->size(); ++i) {
+            (*all_data)[i] = std::make_shared<TreeEntry>();
+        }
+    }
+    return (*all_data)[index];
+}
+
+// calls function with the GIL released, its exceptions are turned into
+// Python errors once the GIL is back, returns false on error
+template<class Function>
+static bool without_gil(Function&& function) {
+    PyObject* error = nullptr;
+    std::string message;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        function();
+    } catch (MemoryLimitError& e) {
+        error = PyExc_MemoryError;
+        message = e.what();
+    } catch (std::bad_alloc&) {
+        // message is left empty, copying one could throw again
+        error = PyExc_MemoryError;
+    } catch (std::exception& e) {
+        error = PyExc_RuntimeError;
+        message = e.what();
+    } catch (...) {
+        // nothing may leave without the GIL
+        error = PyExc_RuntimeError;
+    }
+    Py_END_ALLOW_THREADS
+    if (error == PyExc_MemoryError && message.empty()) {
+        PyErr_NoMemory();
+    } else if (error != nullptr) {
+        PyErr_SetString(error, message.empty() ? "CDFtree failed with unknown error" : message.c_str());
+    }
+    return error == nullptr;
+}
+
+static PyObject* none_or_null(bool done) {
+    if (!done)
+        return NULL;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+
+///////////////////////// OPERATIONS /////////////////////////
+// shared by module functions and methods of Tree, GIL held on entry
+
+static PyObject* insert_into(TreeEntry& entry, PyObject* data) {
+    try {
+        NpyArray<float, 1> input_array(data, false);
+        return none_or_null(without_gil([&] {
+            std::vector<float> samples(input_array.dim_sizes[0]);
+            for (unsigned i = 0; i < samples.size(); ++i) {
+                samples[i] = input_array.unsafe_get(i);
+            }
+            WriteLock lock(entry.mutex);
+            entry.tree.insert_batch(std::move(samples));
+        }));
+    } catch(std::runtime_error& e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return NULL;
+    }
+}
+
+static PyObject* remove_from(TreeEntry& entry, PyObject* data) {
+    try {
+        NpyArray<float, 1> input_array(data, false);
+        return none_or_null(without_gil([&] {
+            WriteLock lock(entry.mutex);
+            for (unsigned i = 0; i < input_array.dim_sizes[0]; ++i) {
+                float sample = input_array.unsafe_get(i);
+                entry.tree.remove_sample(sample);
+            }
+        }));
+    } catch(std::runtime_error& e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return NULL;
+    }
+}
+
+static PyObject* build_into(TreeEntry& entry, PyObject* data) {
+    try {
+        NpyArray<float, 1> input_array(data, false);
+        return none_or_null(without_gil([&] {
+            std::vector<float> samples(input_array.dim_sizes[0]);
+            for (unsigned i = 0; i < input_array.dim_sizes[0]; ++i) {
+                samples[i] = input_array.unsafe_get(i);
+            }
+            CDFTree<float> tree = CDFTree<float>::build(std::move(samples));
+            WriteLock lock(entry.mutex);
+            entry.tree = std::move(tree);
+        }));
+    } catch(std::runtime_error& e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return NULL;
+    }
+}
+
+static PyObject* merge_into(TreeEntry& entry, TreeEntry& source) {
+    return none_or_null(without_gil([&] {
+        if (&entry == &source) {
+            WriteLock lock(entry.mutex);
+            entry.tree.merge(entry.tree);
+            return;
+        }
+        // locks of two trees are always taken in order of their addresses
+        WriteLock lock(entry.mutex, std::defer_lock);
+        ReadLock source_lock(source.mutex, std::defer_lock);
+        if (std::less<TreeEntry*>()(&entry, &source)) {
+            lock.lock();
+            source_lock.lock();
+        } else {
+            source_lock.lock();
+            lock.lock();
+        }
+        entry.tree.merge(source.tree);
+    }));
+}
+
+static PyObject* save_tree(TreeEntry& entry, const char* path) {
+    std::string file(path);
+    return none_or_null(without_gil([&] {
+        ReadLock lock(entry.mutex);
+        entry.tree.save(file);
+    }));
+}
+
+static PyObject* load_into(TreeEntry& entry, const char* path) {
+    std::string file(path);
+    return none_or_null(without_gil([&] {
+        CDFTree<float> tree = CDFTree<float>::load(file);
+        WriteLock lock(entry.mutex);
+        entry.tree = std::move(tree);
+    }));
+}
+
+static PyObject* set_budget(TreeEntry& entry, unsigned long long bytes) {
+    return none_or_null(without_gil([&] {
+        WriteLock lock(entry.mutex);
+        entry.tree.set_memory_budget(bytes);
+    }));
+}
+
+static PyObject* set_limit(TreeEntry& entry, unsigned long long bytes, const char* policy) {
+    MemoryPolicy memory_policy;
+    if (std::string(policy) == "reject")
+        memory_policy = MemoryPolicy::Reject;
+    else if (std::string(policy) == "compact")
+        memory_policy = MemoryPolicy::Compact;
+    else if (std::string(policy) == "approximate")
+        memory_policy = MemoryPolicy::Approximate;
+    else {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree memory policy is one of reject, compact, approximate");
+        return NULL;
+    }
+    return none_or_null(without_gil([&] {
+        WriteLock lock(entry.mutex);
+        entry.tree.set_memory_limit(bytes, memory_policy);
+    }));
+}
+
+static PyObject* tree_stats(TreeEntry& entry) {
+    CDFTreeStats s;
+    bool done = without_gil([&] {
+        ReadLock lock(entry.mutex);
+        s = entry.tree.stats();
+    });
+    if (!done)
+        return NULL;
+    PyObject* levels = PyList_New(s.nodes_per_level.size());
+    if (levels == NULL)
+        return NULL;
+    for (std::size_t i = 0; i < s.nodes_per_level.size(); ++i)
+        PyList_SET_ITEM(levels, i, PyLong_FromSize_t(s.nodes_per_level[i]));
+
+    // N steals reference of levels
+    return Py_BuildValue("{s:I,s:N,s:n,s:n,s:d,s:d,s:n,s:K,s:K,s:K,s:K,s:n,s:n,s:n}",
+            "height", s.height,
+            "nodes_per_level", levels,
+            "internal_nodes", static_cast<Py_ssize_t>(s.internal_nodes),
+            "leaves", static_cast<Py_ssize_t>(s.leaves),
+            "internal_fill", s.internal_fill,
+            "leaf_fill", s.leaf_fill,
+            "distinct", static_cast<Py_ssize_t>(s.distinct),
+            "total", s.total,
+            "leaf_splits", s.leaf_splits,
+            "internal_splits", s.internal_splits,
+            "merges", s.merges,
+            "used_bytes", static_cast<Py_ssize_t>(s.used_bytes),
+            "reserved_bytes", static_cast<Py_ssize_t>(s.reserved_bytes),
+            "allocated_bytes", static_cast<Py_ssize_t>(s.allocated_bytes));
+}
+
+static PyObject* range_count_of(TreeEntry& entry, float lo, float hi) {
+    unsigned long long count = 0;
+    bool done = without_gil([&] {
+        ReadLock lock(entry.mutex);
+        count = entry.tree.range_count(lo, hi);
+    });
+    if (!done)
+        return NULL;
+    return PyLong_FromUnsignedLongLong(count);
+}
+
+// (keys, counts) arrays of all distinct elements in increasing order. Arrays are
+// created while the GIL is held, so their size is read first and the export is
+// repeated if the tree changed meanwhile.
+static PyObject* export_pairs(TreeEntry& entry) {
+    while (true) {
+        std::size_t size = 0;
+        if (!without_gil([&] { ReadLock lock(entry.mutex); size = entry.tree.distinct(); }))
+            return NULL;
+        npy_intp dims[1] = {static_cast<npy_intp>(size)};
+        PyObject* keys = PyArray_SimpleNew(1, dims, NPY_FLOAT32);
+        PyObject* counts = keys == NULL ? NULL : PyArray_SimpleNew(1, dims, NPY_UINT32);
+        if (counts == NULL) {
+            Py_XDECREF(keys);
+            return NULL;
+        }
+        bool exported = false;
+        bool done = without_gil([&] {
+            ReadLock lock(entry.mutex);
+            if (entry.tree.distinct() != size)
+                return;
+            entry.tree.export_to(static_cast<float*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(keys))),
+                    static_cast<unsigned*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(counts))));
+            exported = true;
+        });
+        if (done && exported) {
+            // N steals both references
+            return Py_BuildValue("(NN)", keys, counts);
+        }
+        Py_DECREF(keys);
+        Py_DECREF(counts);
+        if (!done)
+            return NULL;
+    }
+}
+
+static PyObject* cdf_of(TreeEntry& entry, PyObject* data, bool insitu) {
+    try {
+        NpyArray<float, 1> input_array(data, false);
+        // output array is created while the GIL is held
+        std::unique_ptr<NpyArray<float, 1>> output_data;
+        if (!insitu) {
+            output_data.reset(new NpyArray<float, 1>(INIT::EMPTY, input_array.dim_sizes[0]));
+        }
+        NpyArray<float, 1>& output = insitu ? input_array : *output_data;
+
+        bool done = without_gil([&] {
+            std::vector<float> samples(input_array.dim_sizes[0]);
+            for (unsigned i = 0; i < samples.size(); ++i) {
+                samples[i] = input_array.unsafe_get(i);
+            }
+            std::vector<double> cdf;
+            {
+                ReadLock lock(entry.mutex);
+                cdf = entry.tree.search_CDF_batch(samples.data(), samples.size());
+            }
+            for (unsigned i = 0; i < cdf.size(); ++i) {
+                output.unsafe_get(i) = cdf[i];
+            }
+        });
+        if (!done)
+            return NULL;
+        return output.pass_to_python();
+    } catch (std::runtime_error& e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return NULL;
+    }
+}
+
+static PyObject* elements_of(TreeEntry& entry, PyObject* data, bool insitu) {
+    try {
+        NpyArray<float, 1> input_array(data, false);
+        // output array is created while the GIL is held
+        std::unique_ptr<NpyArray<float, 1>> output_data;
+        if (!insitu) {
+            output_data.reset(new NpyArray<float, 1>(INIT::EMPTY, input_array.dim_sizes[0]));
+        }
+        NpyArray<float, 1>& output = insitu ? input_array : *output_data;
+
+        bool done = without_gil([&] {
+            std::vector<double> probabilities(input_array.dim_sizes[0]);
+            for (unsigned i = 0; i < probabilities.size(); ++i) {
+                probabilities[i] = input_array.unsafe_get(i);
+            }
+            std::vector<float> elements;
+            {
+                ReadLock lock(entry.mutex);
+                elements = entry.tree.inverse_search_CDF_batch(probabilities.data(), probabilities.size());
+            }
+            for (unsigned i = 0; i < elements.size(); ++i) {
+                output.unsafe_get(i) = elements[i];
+            }
+        });
+        if (!done)
+            return NULL;
+        return output.pass_to_python();
+    } catch (std::runtime_error& e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return NULL;
+    }
+}
+
+// 2D float32 array read and written through its strides, without a copy
+struct Columns {
+    char*       data;
+    npy_intp    rows;
+    npy_intp    count;
+    npy_intp    row_stride;
+    npy_intp    column_stride;
+
+    float& at(npy_intp row, npy_intp column) const {
+        return *reinterpret_cast<float*>(data + row * row_stride + column * column_stride);
+    }
+};
+
+// sets Python error and returns false if data is no 2D float32 array
+static bool columns_of(PyObject* data, Columns& columns) {
+    if (!PyArray_Check(data)) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree expects numpy array");
+        return false;
+    }
+    PyArrayObject* array = reinterpret_cast<PyArrayObject*>(data);
+    if (PyArray_TYPE(array) != NPY_FLOAT32 || PyArray_NDIM(array) != 2) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree expects 2D array of float32");
+        return false;
+    }
+    columns.data = static_cast<char*>(PyArray_DATA(array));
+    columns.rows = PyArray_DIMS(array)[0];
+    columns.count = PyArray_DIMS(array)[1];
+    columns.row_stride = PyArray_STRIDES(array)[0];
+    columns.column_stride = PyArray_STRIDES(array)[1];
+    return true;
+}
+
+// calls function(column, tree) for all columns, spread over threads, GIL
+// released; columns are independent, the first error is raised once all are done
+template<class Function>
+static bool for_each_column(const std::vector<std::shared_ptr<TreeEntry>>& entries, Function&& function) {
+    return without_gil([&] {
+        std::exception_ptr failure;
+        std::mutex failure_mutex;
+        utils::parallel_for(entries.size(), [&](std::size_t first, std::size_t last) {
+            for (std::size_t column = first; column < last; ++column) {
+                try {
+                    function(column, *entries[column]);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(failure_mutex);
+                    if (!failure)
+                        failure = std::current_exception();
+                }
+            }
+        });
+        if (failure)
+            std::rethrow_exception(failure);
+    });
+}
+
+static PyObject* insert_columns(const std::vector<std::shared_ptr<TreeEntry>>& entries, const Columns& columns) {
+    return none_or_null(for_each_column(entries, [&](std::size_t column, TreeEntry& entry) {
+        std::vector<float> samples(columns.rows);
+        for (npy_intp row = 0; row < columns.rows; ++row) {
+            samples[row] = columns.at(row, column);
+        }
+        // columns run in parallel already, each one takes a single thread
+        WriteLock lock(entry.mutex);
+        entry.tree.insert_batch(std::move(samples), 1);
+    }));
+}
+
+static PyObject* cdf_of_columns(const std::vector<std::shared_ptr<TreeEntry>>& entries, PyObject* data,
+        const Columns& columns, bool insitu) {
+    PyArrayObject* array = reinterpret_cast<PyArrayObject*>(data);
+    // output keeps memory layout of the input
+    PyObject* result;
+    if (insitu) {
+        if (!PyArray_ISWRITEABLE(array)) {
+            PyErr_SetString(PyExc_RuntimeError, "CDFtree cannot write into read-only array");
+            return NULL;
+        }
+        Py_INCREF(data);
+        result = data;
+    } else {
+        result = PyArray_NewLikeArray(array, NPY_KEEPORDER, NULL, 0);
+        if (result == NULL)
+            return NULL;
+    }
+    Columns output;
+    if (!columns_of(result, output)) {
+        Py_DECREF(result);
+        return NULL;
+    }
+
+    bool done = for_each_column(entries, [&](std::size_t column, TreeEntry& entry) {
+        std::vector<float> samples(columns.rows);
+        for (npy_intp row = 0; row < columns.rows; ++row) {
+            samples[row] = columns.at(row, column);
+        }
+        std::vector<double> cdf;
+        {
+            ReadLock lock(entry.mutex);
+            cdf = entry.tree.search_CDF_batch(samples.data(), samples.size(), 1);
+        }
+        for (npy_intp row = 0; row < columns.rows; ++row) {
+            output.at(row, column) = cdf[row];
+        }
+    });
+    if (!done) {
+        Py_DECREF(result);
+        return NULL;
+    }
+    return result;
+}
 
 
 extern "C" {
+
+///////////////////////// TREE OBJECT /////////////////////////
+// Tree owns a single tree, no global state is involved, methods are
+// module functions without the index
+
+struct TreeObject {
+    PyObject_HEAD
+    TreeEntry* entry;
+};
+
+static PyTypeObject TreeType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+};
+
+static PyObject * Tree_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+    if (!PyArg_ParseTuple(args, "") || (kwds != NULL && PyDict_Size(kwds) > 0)) {
+        PyErr_SetString(PyExc_TypeError, "Tree takes no arguments");
+        return NULL;
+    }
+    TreeObject* self = reinterpret_cast<TreeObject*>(type->tp_alloc(type, 0));
+    if (self == NULL)
+        return NULL;
+    self->entry = new (std::nothrow) TreeEntry();
+    if (self->entry == nullptr) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    return reinterpret_cast<PyObject*>(self);
+}
+
+static void Tree_dealloc(TreeObject *self) {
+    delete self->entry;
+    Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+static PyObject * Tree_insert_sample(TreeObject *self, PyObject *args) {
+    PyObject *data;
+    if (!PyArg_ParseTuple(args, "O", &data))
+        return NULL;
+    return insert_into(*self->entry, data);
+}
+
+static PyObject * Tree_remove_sample(TreeObject *self, PyObject *args) {
+    PyObject *data;
+    if (!PyArg_ParseTuple(args, "O", &data))
+        return NULL;
+    return remove_from(*self->entry, data);
+}
+
+static PyObject * Tree_build_from_samples(TreeObject *self, PyObject *args) {
+    PyObject *data;
+    if (!PyArg_ParseTuple(args, "O", &data))
+        return NULL;
+    return build_into(*self->entry, data);
+}
+
+static PyObject * Tree_merge(TreeObject *self, PyObject *args) {
+    TreeObject *other;
+    if (!PyArg_ParseTuple(args, "O!", &TreeType, &other))
+        return NULL;
+    return merge_into(*self->entry, *other->entry);
+}
+
+static PyObject * Tree_save(TreeObject *self, PyObject *args) {
+    const char* path;
+    if (!PyArg_ParseTuple(args, "s", &path))
+        return NULL;
+    return save_tree(*self->entry, path);
+}
+
+static PyObject * Tree_load(TreeObject *self, PyObject *args) {
+    const char* path;
+    if (!PyArg_ParseTuple(args, "s", &path))
+        return NULL;
+    return load_into(*self->entry, path);
+}
+
+static PyObject * Tree_set_memory_budget(TreeObject *self, PyObject *args) {
+    unsigned long long bytes;
+    if (!PyArg_ParseTuple(args, "K", &bytes))
+        return NULL;
+    return set_budget(*self->entry, bytes);
+}
+
+static PyObject * Tree_set_memory_limit(TreeObject *self, PyObject *args) {
+    unsigned long long bytes;
+    const char* policy = "reject";
+    if (!PyArg_ParseTuple(args, "K|s", &bytes, &policy))
+        return NULL;
+    return set_limit(*self->entry, bytes, policy);
+}
+
+static PyObject * Tree_stats(TreeObject *self, PyObject *args) {
+    (void)args;
+    return tree_stats(*self->entry);
+}
+
+static PyObject * Tree_range_count(TreeObject *self, PyObject *args) {
+    float lo, hi;
+    if (!PyArg_ParseTuple(args, "ff", &lo, &hi))
+        return NULL;
+    return range_count_of(*self->entry, lo, hi);
+}
+
+static PyObject * Tree_export_sorted(TreeObject *self, PyObject *args) {
+    (void)args;
+    return export_pairs(*self->entry);
+}
+
+static PyObject * Tree_sample_to_cdf(TreeObject *self, PyObject *args) {
+    PyObject *data;
+    bool insitu = true;
+    if (!PyArg_ParseTuple(args, "O|b", &data, &insitu))
+        return NULL;
+    return cdf_of(*self->entry, data, insitu);
+}
+
+static PyObject * Tree_search_element_by_cdf(TreeObject *self, PyObject *args) {
+    PyObject *data;
+    bool insitu = true;
+    if (!PyArg_ParseTuple(args, "O|b", &data, &insitu))
+        return NULL;
+    return elements_of(*self->entry, data, insitu);
+}
+
+static PyMethodDef TreeMethods[] = {
+    {"insert_sample", reinterpret_cast<PyCFunction>(Tree_insert_sample), METH_VARARGS, "doc"},
+    {"remove_sample", reinterpret_cast<PyCFunction>(Tree_remove_sample), METH_VARARGS, "doc"},
+    {"build_from_samples", reinterpret_cast<PyCFunction>(Tree_build_from_samples), METH_VARARGS, "doc"},
+    {"merge", reinterpret_cast<PyCFunction>(Tree_merge), METH_VARARGS, "doc"},
+    {"save", reinterpret_cast<PyCFunction>(Tree_save), METH_VARARGS, "doc"},
+    {"load", reinterpret_cast<PyCFunction>(Tree_load), METH_VARARGS, "doc"},
+    {"set_memory_budget", reinterpret_cast<PyCFunction>(Tree_set_memory_budget), METH_VARARGS, "doc"},
+    {"set_memory_limit", reinterpret_cast<PyCFunction>(Tree_set_memory_limit), METH_VARARGS, "doc"},
+    {"stats", reinterpret_cast<PyCFunction>(Tree_stats), METH_NOARGS, "doc"},
+    {"range_count", reinterpret_cast<PyCFunction>(Tree_range_count), METH_VARARGS, "doc"},
+    {"export_sorted", reinterpret_cast<PyCFunction>(Tree_export_sorted), METH_NOARGS, "doc"},
+    {"sample_to_cdf", reinterpret_cast<PyCFunction>(Tree_sample_to_cdf), METH_VARARGS, "doc"},
+    {"search_element_by_cdf", reinterpret_cast<PyCFunction>(Tree_search_element_by_cdf), METH_VARARGS, "doc"},
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+
+///////////////////////// MODULE FUNCTIONS /////////////////////////
+// trees addressed by index into all_data, between init_memory and free_memory
+
 static PyObject * insert_sample(PyObject *self, PyObject *args) {
     (void)self;
     int index;
@@ -31,29 +621,250 @@ static PyObject * insert_sample(PyObject *self, PyObject *args) {
         PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to write into unallocated memory");
         return NULL;
     }
-    try {
-        if (index < 0) {
-            throw std::runtime_error("CDFtree index can be only positive number");
-        }
-        if (all_data->size() <= static_cast<unsigned>(index)) {
-            all_data->resize(index+1);
-        }
+    if (index < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree index can be only positive number");
+        return NULL;
+    }
+    std::shared_ptr<TreeEntry> entry = tree_at(index);
+    return insert_into(*entry, data);
+}
 
-        NpyArray<float, 1> input_array(data, false);
-        for (unsigned i = 0; i < input_array.dim_sizes[0]; ++i) {
-            float sample = input_array.unsafe_get(i);
-            (*all_data)[index].insert_sample(sample);
-        }
 
-        Py_INCREF(Py_None);
-        return Py_None;
-    } catch(std::runtime_error& e) {
-        PyErr_SetString(PyExc_RuntimeError, e.what());
+static PyObject * remove_sample(PyObject *self, PyObject *args) {
+    (void)self;
+    int index;
+    PyObject *data;
+
+    if (!PyArg_ParseTuple(args, "iO", &index, &data))
+        return NULL;
+    if (all_data == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to write into unallocated memory");
+        return NULL;
+    }
+    if (index < 0 or all_data->size() <= static_cast<unsigned>(index)) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to use unallocated tree [possibly bad index?]");
         return NULL;
     }
+    std::shared_ptr<TreeEntry> entry = (*all_data)[index];
+    return remove_from(*entry, data);
 }
 
 
+static PyObject * build_from_samples(PyObject *self, PyObject *args) {
+    (void)self;
+    int index;
+    PyObject *data;
+
+    if (!PyArg_ParseTuple(args, "iO", &index, &data))
+        return NULL;
+    if (all_data == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to write into unallocated memory");
+        return NULL;
+    }
+    if (index < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree index can be only positive number");
+        return NULL;
+    }
+    std::shared_ptr<TreeEntry> entry = tree_at(index);
+    return build_into(*entry, data);
+}
+
+static PyObject * merge(PyObject *self, PyObject *args) {
+    (void)self;
+    int index, other;
+
+    if (!PyArg_ParseTuple(args, "ii", &index, &other))
+        return NULL;
+
+    if (all_data == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to use unallocated memory");
+        return NULL;
+    }
+    if (index < 0 or other < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree index can be only positive number");
+        return NULL;
+    }
+    if (all_data->size() <= static_cast<unsigned>(std::max(index, other))) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to use unallocated tree [possibly bad index?]");
+        return NULL;
+    }
+
+    std::shared_ptr<TreeEntry> entry = (*all_data)[index];
+    std::shared_ptr<TreeEntry> source = (*all_data)[other];
+    return merge_into(*entry, *source);
+}
+
+static PyObject * save(PyObject *self, PyObject *args) {
+    (void)self;
+    int index;
+    const char* path;
+
+    if (!PyArg_ParseTuple(args, "is", &index, &path))
+        return NULL;
+
+    if (all_data == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to use unallocated memory");
+        return NULL;
+    }
+    if (index < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree index can be only positive number");
+        return NULL;
+    }
+    if (all_data->size() <= static_cast<unsigned>(index)) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to use unallocated tree [possibly bad index?]");
+        return NULL;
+    }
+
+    std::shared_ptr<TreeEntry> entry = (*all_data)[index];
+    return save_tree(*entry, path);
+}
+
+static PyObject * load(PyObject *self, PyObject *args) {
+    (void)self;
+    int index;
+    const char* path;
+
+    if (!PyArg_ParseTuple(args, "is", &index, &path))
+        return NULL;
+
+    if (all_data == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to write into unallocated memory");
+        return NULL;
+    }
+    if (index < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree index can be only positive number");
+        return NULL;
+    }
+
+    std::shared_ptr<TreeEntry> entry = tree_at(index);
+    return load_into(*entry, path);
+}
+
+static PyObject * set_memory_budget(PyObject *self, PyObject *args) {
+    (void)self;
+    int index;
+    unsigned long long bytes;
+
+    if (!PyArg_ParseTuple(args, "iK", &index, &bytes))
+        return NULL;
+
+    if (all_data == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to write into unallocated memory");
+        return NULL;
+    }
+    if (index < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree index can be only positive number");
+        return NULL;
+    }
+
+    std::shared_ptr<TreeEntry> entry = tree_at(index);
+    return set_budget(*entry, bytes);
+}
+
+static PyObject * set_memory_limit(PyObject *self, PyObject *args) {
+    (void)self;
+    int index;
+    unsigned long long bytes;
+    const char* policy = "reject";
+
+    if (!PyArg_ParseTuple(args, "iK|s", &index, &bytes, &policy))
+        return NULL;
+
+    if (all_data == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to write into unallocated memory");
+        return NULL;
+    }
+    if (index < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree index can be only positive number");
+        return NULL;
+    }
+
+    std::shared_ptr<TreeEntry> entry = tree_at(index);
+    return set_limit(*entry, bytes, policy);
+}
+
+// limit of all trees together (0 means none) and bytes they hold
+static PyObject * set_process_memory_limit(PyObject *self, PyObject *args) {
+    (void)self;
+    unsigned long long bytes;
+
+    if (!PyArg_ParseTuple(args, "K", &bytes))
+        return NULL;
+    MemoryRegistry::instance().set_limit(bytes);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject * process_memory_usage(PyObject *self, PyObject *args) {
+    (void)self; (void)args;
+    return PyLong_FromSize_t(MemoryRegistry::instance().allocated());
+}
+
+static PyObject * stats(PyObject *self, PyObject *args) {
+    (void)self;
+    int index;
+
+    if (!PyArg_ParseTuple(args, "i", &index))
+        return NULL;
+
+    if (all_data == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to use unallocated memory");
+        return NULL;
+    }
+    if (index < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree index can be only positive number");
+        return NULL;
+    }
+    if (all_data->size() <= static_cast<unsigned>(index)) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to use unallocated tree [possibly bad index?]");
+        return NULL;
+    }
+
+    std::shared_ptr<TreeEntry> entry = (*all_data)[index];
+    return tree_stats(*entry);
+}
+
+static PyObject * range_count(PyObject *self, PyObject *args) {
+    (void)self;
+    int index;
+    float lo, hi;
+
+    if (!PyArg_ParseTuple(args, "iff", &index, &lo, &hi))
+        return NULL;
+
+    if (all_data == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to use unallocated memory");
+        return NULL;
+    }
+    if (index < 0 or all_data->size() <= static_cast<unsigned>(index)) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to use unallocated tree [possibly bad index?]");
+        return NULL;
+    }
+
+    std::shared_ptr<TreeEntry> entry = (*all_data)[index];
+    return range_count_of(*entry, lo, hi);
+}
+
+static PyObject * export_sorted(PyObject *self, PyObject *args) {
+    (void)self;
+    int index;
+
+    if (!PyArg_ParseTuple(args, "i", &index))
+        return NULL;
+
+    if (all_data == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to use unallocated memory");
+        return NULL;
+    }
+    if (index < 0 or all_data->size() <= static_cast<unsigned>(index)) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to use unallocated tree [possibly bad index?]");
+        return NULL;
+    }
+
+    std::shared_ptr<TreeEntry> entry = (*all_data)[index];
+    return export_pairs(*entry);
+}
+
 static PyObject * sample_to_cdf(PyObject *self, PyObject *args) {
     (void)self;
     int index;
@@ -76,30 +887,72 @@ static PyObject * sample_to_cdf(PyObject *self, PyObject *args) {
         return NULL;
     }
 
-    try { 
-        NpyArray<float, 1> input_array(data, false);
-        auto& tree = (*all_data)[index];
+    std::shared_ptr<TreeEntry> entry = (*all_data)[index];
+    return cdf_of(*entry, data, insitu);
+}
 
-        if (insitu) {
-            for (unsigned i = 0; i < input_array.dim_sizes[0]; ++i) {
-                float& sample = input_array.unsafe_get(i);
-                sample = tree.search_CDF(sample);
-            }
-            return input_array.pass_to_python();
-        }
-        else {
-            NpyArray<float, 1> output_data(INIT::EMPTY, input_array.dim_sizes[0]);
+// column j of a 2D array goes to tree base + j
+static PyObject * insert_sample_columns(PyObject *self, PyObject *args) {
+    (void)self;
+    int base;
+    PyObject *data;
 
-            for (unsigned i = 0; i < input_array.dim_sizes[0]; ++i) {
-                float sample = input_array.unsafe_get(i);
-                output_data.unsafe_get(i) = tree.search_CDF(sample);
-            }
-            return output_data.pass_to_python();
-        }
-    } catch (std::runtime_error& e) {
-        PyErr_SetString(PyExc_RuntimeError, e.what());
+    if (!PyArg_ParseTuple(args, "iO", &base, &data))
+        return NULL;
+
+    if (all_data == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to write into unallocated memory");
+        return NULL;
+    }
+    if (base < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree index can be only positive number");
+        return NULL;
+    }
+    Columns columns;
+    if (!columns_of(data, columns))
+        return NULL;
+    if (columns.count == 0) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+
+    // trees are addressed by int, last one must be one too
+    if (columns.count - 1 > std::numeric_limits<int>::max() - base) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree index of the last column does not fit int");
         return NULL;
     }
+    tree_at(static_cast<int>(base + columns.count - 1));
+    std::vector<std::shared_ptr<TreeEntry>> entries(all_data->begin() + base, all_data->begin() + base + columns.count);
+    return insert_columns(entries, columns);
+}
+
+static PyObject * sample_to_cdf_columns(PyObject *self, PyObject *args) {
+    (void)self;
+    int base;
+    PyObject *data;
+    bool insitu = true;
+
+    if (!PyArg_ParseTuple(args, "iO|b", &base, &data, &insitu))
+        return NULL;
+
+    if (all_data == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to use unallocated memory");
+        return NULL;
+    }
+    if (base < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree index can be only positive number");
+        return NULL;
+    }
+    Columns columns;
+    if (!columns_of(data, columns))
+        return NULL;
+    if (all_data->size() < static_cast<std::size_t>(base) + columns.count) {
+        PyErr_SetString(PyExc_RuntimeError, "CDFtree wants to use unallocated tree [possibly bad index?]");
+        return NULL;
+    }
+
+    std::vector<std::shared_ptr<TreeEntry>> entries(all_data->begin() + base, all_data->begin() + base + columns.count);
+    return cdf_of_columns(entries, data, columns, insitu);
 }
 
 static PyObject * search_element_by_cdf(PyObject *self, PyObject *args) {
@@ -122,36 +975,15 @@ static PyObject * search_element_by_cdf(PyObject *self, PyObject *args) {
         return NULL;
     }
 
-    try {
-        NpyArray<float, 1> input_array(data, false);
-        auto& tree = (*all_data)[index];
-
-        if (insitu) {
-            for (unsigned i = 0; i < input_array.dim_sizes[0]; ++i) {
-                float& sample = input_array.safe_get(i);
-                sample = tree.inverse_search_CDF(sample);
-            }
-            return input_array.pass_to_python();
-        } else {
-            NpyArray<float, 1> output_data(INIT::EMPTY, input_array.dim_sizes[0]);
-
-            for (unsigned i = 0; i < input_array.dim_sizes[0]; ++i) {
-                float sample = input_array.unsafe_get(i);
-                output_data.unsafe_get(i) = tree.inverse_search_CDF(sample);
-            }
-            return output_data.pass_to_python();
-        }
-    } catch (std::runtime_error& e) {
-        PyErr_SetString(PyExc_RuntimeError, e.what());
-        return NULL;
-    }
+    std::shared_ptr<TreeEntry> entry = (*all_data)[index];
+    return elements_of(*entry, data, insitu);
 }
 
 
 
 static PyObject * init_memory(PyObject *self, PyObject *args) {
     (void)args; (void)self;
-    all_data = new std::vector<CDFTree<float>>();
+    all_data = new std::vector<std::shared_ptr<TreeEntry>>();
     Py_INCREF(Py_None);
     return Py_None;
 }
@@ -169,8 +1001,22 @@ static const char* doc = NULL;
 
 static PyMethodDef Methods[] = {
     {"insert_sample", insert_sample, METH_VARARGS, "doc"},
+    {"remove_sample", remove_sample, METH_VARARGS, "doc"},
+    {"build_from_samples", build_from_samples, METH_VARARGS, "doc"},
+    {"merge", merge, METH_VARARGS, "doc"},
+    {"save", save, METH_VARARGS, "doc"},
+    {"load", load, METH_VARARGS, "doc"},
+    {"set_memory_budget", set_memory_budget, METH_VARARGS, "doc"},
+    {"set_memory_limit", set_memory_limit, METH_VARARGS, "doc"},
+    {"set_process_memory_limit", set_process_memory_limit, METH_VARARGS, "doc"},
+    {"process_memory_usage", process_memory_usage, METH_NOARGS, "doc"},
+    {"stats", stats, METH_VARARGS, "doc"},
+    {"range_count", range_count, METH_VARARGS, "doc"},
+    {"export_sorted", export_sorted, METH_VARARGS, "doc"},
     {"sample_to_cdf", sample_to_cdf, METH_VARARGS, "doc"},
     {"search_element_by_cdf", search_element_by_cdf, METH_VARARGS, "doc"},
+    {"insert_sample_columns", insert_sample_columns, METH_VARARGS, "doc"},
+    {"sample_to_cdf_columns", sample_to_cdf_columns, METH_VARARGS, "doc"},
     {"free_memory", free_memory, METH_VARARGS, "doc"},
     {"init_memory", init_memory, METH_VARARGS, "doc"},
     {NULL, NULL, 0, NULL}        /* Sentinel */
@@ -190,10 +1036,28 @@ PyMODINIT_FUNC PyInit_libcdftree(void)
 {
     PyObject *m;
 
+    TreeType.tp_name = "libcdftree.Tree";
+    TreeType.tp_doc = "CDF tree of float32 samples";
+    TreeType.tp_basicsize = sizeof(TreeObject);
+    TreeType.tp_itemsize = 0;
+    TreeType.tp_flags = Py_TPFLAGS_DEFAULT;
+    TreeType.tp_new = Tree_new;
+    TreeType.tp_dealloc = reinterpret_cast<destructor>(Tree_dealloc);
+    TreeType.tp_methods = TreeMethods;
+    if (PyType_Ready(&TreeType) < 0)
+        return NULL;
+
     m = PyModule_Create(&module);
     if (m == NULL)
         return NULL;
 
+    Py_INCREF(&TreeType);
+    if (PyModule_AddObject(m, "Tree", reinterpret_cast<PyObject*>(&TreeType)) < 0) {
+        Py_DECREF(&TreeType);
+        Py_DECREF(m);
+        return NULL;
+    }
+
     import_array();
     if (PyErr_Occurred()) return NULL;
     /* you can create some objects here <errors...> */
@@ -0,0 +1,93 @@
+#if not defined INCLUDED_PARALLEL
+#define INCLUDED_PARALLEL
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
+
+///////////////////////// PARALLEL UTILS //////////////////////
+namespace utils {
+
+inline unsigned thread_count() {
+    unsigned threads = std::thread::hardware_concurrency();
+    return threads == 0 ? 1 : threads;
+}
+
+template<class Function>
+void parallel_for(std::size_t size, Function function, unsigned threads = thread_count()) {
+    // calls function(begin, end) for disjoint chunks covering [0, size), an exception
+    // of any chunk is rethrown once all threads are joined (the first chunk's wins)
+    threads = static_cast<unsigned>(std::min<std::size_t>(threads, size));
+    if (threads <= 1) {
+        if (size > 0)
+            function(std::size_t(0), size);
+        return;
+    }
+
+    std::vector<std::exception_ptr> errors(threads);
+    auto chunk = [&](unsigned t) {
+        try {
+            function(size * t / threads, size * (t + 1) / threads);
+        } catch (...) {
+            errors[t] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    try {
+        for (unsigned t = 1; t < threads; ++t)
+            workers.emplace_back(chunk, t);
+    } catch (...) {
+        // no more threads, started ones must not outlive the call
+        for (auto& worker : workers)
+            worker.join();
+        throw;
+    }
+    chunk(0);
+    for (auto& worker : workers)
+        worker.join();
+    for (auto& error : errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
+template<class Iterator, class Compare = std::less<>>
+void parallel_sort(Iterator begin, Iterator end, Compare compare = Compare(), unsigned threads = thread_count()) {
+    // chunks are sorted independently and merged pairwise
+    constexpr std::size_t MinimalChunk = 1 << 16;
+    std::size_t size = end - begin;
+
+    unsigned chunks = 1;
+    while (chunks * 2 <= threads and size / (chunks * 2) >= MinimalChunk)
+        chunks *= 2;
+    if (chunks == 1) {
+        std::sort(begin, end, compare);
+        return;
+    }
+
+    std::vector<Iterator> bounds;
+    for (unsigned c = 0; c <= chunks; ++c)
+        bounds.push_back(begin + size * c / chunks);
+
+    parallel_for(chunks, [&](std::size_t first, std::size_t last) {
+        for (std::size_t c = first; c < last; ++c)
+            std::sort(bounds[c], bounds[c + 1], compare);
+    }, chunks);
+
+    for (unsigned width = 1; width < chunks; width *= 2) {
+        unsigned merges = chunks / (2 * width);
+        parallel_for(merges, [&](std::size_t first, std::size_t last) {
+            for (std::size_t m = first; m < last; ++m) {
+                std::size_t c = m * 2 * width;
+                std::inplace_merge(bounds[c], bounds[c + width], bounds[c + 2 * width], compare);
+            }
+        }, merges);
+    }
+}
+
+} // end namespace utils
+
+#endif // INCLUDED_PARALLEL
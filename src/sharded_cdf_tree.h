@@ -0,0 +1,230 @@
+#if not defined INCLUDED_SHARDED_CDF_TREE
+#define INCLUDED_SHARDED_CDF_TREE
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <stdexcept>
+
+#include "cdf_tree_main.h"
+#include "parallel.h"
+
+
+template<class Type>
+class ShardedCDFTree {
+    // Every shard is an independent tree with its own arena, so threads inserting
+    // into different shards never touch shared memory. Queries combine all shards:
+    // CDF is the sum of per-shard ranks, inverse search narrows per-shard rank
+    // intervals until a single element is left. Queries must not run together with inserts.
+    // Elements are stored encoded as in CDFTree, see key_traits.h.
+    using Traits = KeyTraits<Type>;
+    using Key = typename Traits::Stored;
+    using RootNodeClusterType = RootNodeCluster<Key>;
+
+public:
+    explicit ShardedCDFTree(unsigned shards = utils::thread_count());
+
+    unsigned shard_count() const { return shards.size(); }
+
+    // element -> probability
+    double search_PDF(Type) const;
+    unsigned search_count(Type) const;
+    // update, each shard can be used by one thread at a time
+    void insert_sample(unsigned shard, Type e, unsigned count = 1);
+    // batch is split evenly among shards which are filled in parallel. If a shard
+    // throws, the others are still filled and the first error is rethrown; samples
+    // are not rolled back, the failing shard keeps elements inserted before the error.
+    void insert_batch(const Type* samples, std::size_t size);
+    // element -> cummulative probability
+    double search_CDF(Type e) const;
+    // cummulative proabibility -> element
+    Type inverse_search_CDF(double) const;
+
+    Type minimal_element() const;
+    Type maximal_element() const;
+
+    // number of samples in all shards
+    unsigned long long size() const;
+
+    void clear();
+
+protected:
+    unsigned long long search_CDF_count(Type e) const;
+
+    std::vector<std::shared_ptr<RootNodeClusterType>> shards;
+};
+
+
+template<class Type>
+ShardedCDFTree<Type>::ShardedCDFTree(unsigned shard_count) : shards(shard_count) {
+    if (shard_count == 0)
+        throw std::runtime_error("ShardedCDFTree: at least one shard is needed");
+    clear();
+}
+
+template<class Type>
+void ShardedCDFTree<Type>::clear() {
+    for (auto& shard : shards)
+        shard = RootNodeClusterType::factory();
+}
+
+template<class Type>
+inline void ShardedCDFTree<Type>::insert_sample(unsigned shard, Type e, unsigned count) {
+    BOOST_ASSERT(shard < shards.size());
+    shards[shard]->insert_sample(Traits::encode(e), count);
+}
+
+template<class Type>
+void ShardedCDFTree<Type>::insert_batch(const Type* samples, std::size_t size) {
+    // parallel_for joins all shards before an exception reaches the caller
+    std::size_t count = shards.size();
+    utils::parallel_for(count, [&](std::size_t first, std::size_t last) {
+        std::vector<Key> keys;
+        std::vector<unsigned> counts;
+        for (std::size_t s = first; s < last; ++s) {
+            std::vector<Key> sorted = Traits::encode(
+                    std::vector<Type>(samples + size * s / count, samples + size * (s + 1) / count));
+            std::sort(sorted.begin(), sorted.end());
+            utils::aggregate_sorted(sorted.data(), sorted.size(), keys, counts);
+            shards[s]->insert_sorted(keys.data(), counts.data(), keys.size());
+        }
+    }, count);
+}
+
+template<class Type>
+unsigned long long ShardedCDFTree<Type>::size() const {
+    unsigned long long total = 0;
+    for (auto& shard : shards)
+        total += shard->total();
+    return total;
+}
+
+template<class Type>
+inline unsigned ShardedCDFTree<Type>::search_count(Type e) const {
+    Key key = Traits::encode(e);
+    unsigned count = 0;
+    for (auto& shard : shards)
+        count += shard->search_PDF(key);
+    return count;
+}
+
+template<class Type>
+inline double ShardedCDFTree<Type>::search_PDF(Type e) const {
+    return static_cast<double>(search_count(e)) / size();
+}
+
+template<class Type>
+inline unsigned long long ShardedCDFTree<Type>::search_CDF_count(Type e) const {
+    Key key = Traits::encode(e);
+    unsigned long long sum = 0;
+    for (auto& shard : shards)
+        sum += shard->search_CDF(key);
+    return sum;
+}
+
+template<class Type>
+inline double ShardedCDFTree<Type>::search_CDF(Type e) const {
+    return static_cast<double>(search_CDF_count(e)) / size();
+}
+
+template<class Type>
+Type ShardedCDFTree<Type>::inverse_search_CDF(double e) const {
+    unsigned count = shards.size();
+    std::vector<unsigned long long> lower(count, 0), upper(count), ranks(count);
+    unsigned long long total = 0;
+    for (unsigned s = 0; s < count; ++s) {
+        upper[s] = shards[s]->total();
+        total += upper[s];
+    }
+
+    unsigned long long b = static_cast<unsigned long long>(std::ceil(e*total));
+    if (b <= 0) {
+        throw std::runtime_error("Inversion of CDF=0 is impossible to obtain");
+    }
+    if (b > total)
+        throw std::runtime_error("Inverse search failed");
+
+    // Candidates of shard s are its elements with local CDF in (lower[s], upper[s]].
+    // Element m either reaches b and nothing above it is needed, or it does not
+    // and nothing up to it is needed.
+    bool found = false;
+    Key best = Key();
+    auto narrow = [&](Key m) {
+        unsigned long long sum = 0;
+        for (unsigned t = 0; t < count; ++t) {
+            ranks[t] = shards[t]->search_CDF(m);
+            sum += ranks[t];
+        }
+        if (sum >= b) {
+            if (not found or m < best)
+                best = m;
+            found = true;
+            for (unsigned t = 0; t < count; ++t)
+                upper[t] = std::min(upper[t], ranks[t] - shards[t]->search_PDF(m));
+        } else {
+            for (unsigned t = 0; t < count; ++t)
+                lower[t] = std::max(lower[t], ranks[t]);
+        }
+    };
+
+    // widest interval is cut where the answer is expected, every other step halves it
+    for (unsigned step = 0; ; ++step) {
+        unsigned widest = 0;
+        unsigned long long below = 0, inside = 0;
+        for (unsigned s = 0; s < count; ++s) {
+            below += lower[s];
+            inside += upper[s] - lower[s];
+            if (upper[s] - lower[s] > upper[widest] - lower[widest])
+                widest = s;
+        }
+        unsigned long long width = upper[widest] - lower[widest];
+        if (width == 0)
+            break;
+        unsigned long long offset = (width + 1) / 2;
+        if (step % 2 == 0 and b > below) {
+            double fraction = static_cast<double>(b - below) / inside;
+            offset = static_cast<unsigned long long>(std::ceil(fraction * width));
+            offset = std::min(std::max(offset, 1ull), width);
+        }
+        narrow(shards[widest]->inverse_search_CDF(lower[widest] + offset));
+    }
+
+    BOOST_ASSERT(found);
+    return Traits::decode(best);
+}
+
+template<class Type>
+Type ShardedCDFTree<Type>::minimal_element() const {
+    bool found = false;
+    Key result = Key();
+    for (auto& shard : shards)
+        if (shard->total() > 0) {
+            Key e = shard->minimal_element();
+            if (not found or e < result)
+                result = e;
+            found = true;
+        }
+    if (not found)
+        throw std::runtime_error("Mininal Element on empty tree");
+    return Traits::decode(result);
+}
+
+template<class Type>
+Type ShardedCDFTree<Type>::maximal_element() const {
+    bool found = false;
+    Key result = Key();
+    for (auto& shard : shards)
+        if (shard->total() > 0) {
+            Key e = shard->maximal_element();
+            if (not found or result < e)
+                result = e;
+            found = true;
+        }
+    if (not found)
+        throw std::runtime_error("Maximal Element on empty tree");
+    return Traits::decode(result);
+}
+
+#endif // INCLUDED_SHARDED_CDF_TREE
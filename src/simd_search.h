@@ -0,0 +1,330 @@
+#if not defined INCLUDED_SIMD_SEARCH
+#define INCLUDED_SIMD_SEARCH
+
+#include <cstdint>
+#include <type_traits>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CDFTREE_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+///////////////////////// SIMD SEARCH /////////////////////////
+// Counting search in sorted arrays of cluster keys:
+//   count_less_equal -> number of elements <= key
+//   count_less       -> number of elements <  key
+// Branchless bisection narrows the range to a small window which is then
+// counted by vector compares. Instruction set is selected at runtime so one
+// build runs on every host.
+namespace utils {
+namespace simd {
+
+enum class Isa { Scalar = 0, SSE42 = 1, AVX2 = 2, AVX512 = 3 };
+
+inline Isa detect_isa() {
+#if defined CDFTREE_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return Isa::AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return Isa::AVX2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return Isa::SSE42;
+#endif
+    return Isa::Scalar;
+}
+
+// detected when the library is loaded (zero initialized value is Scalar,
+// so searches done during static initialization are still correct)
+inline const Isa cpu_isa = detect_isa();
+
+template<class T>
+struct is_supported : std::integral_constant<bool,
+    std::is_same<T, int>::value or std::is_same<T, unsigned>::value or
+    std::is_same<T, std::uint64_t>::value or
+    std::is_same<T, float>::value or std::is_same<T, double>::value> {};
+
+
+template<bool Strict, class T>
+inline unsigned count_scalar(const T* array, unsigned size, T key) {
+    unsigned count = 0;
+    for (unsigned i = 0; i < size; ++i)
+        count += Strict ? (array[i] < key) : (array[i] <= key);
+    return count;
+}
+
+#if defined CDFTREE_SIMD_X86
+
+///////////////////////// SSE4.2 ////////////////////////////
+
+template<bool Strict>
+__attribute__((target("sse4.2,popcnt")))
+inline unsigned count_sse42(const int* array, unsigned size, int key) {
+    const __m128i k = _mm_set1_epi32(key);
+    unsigned i = 0, count = 0;
+    for (; i + 4 <= size; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(array + i));
+        __m128i m = Strict ? _mm_cmpgt_epi32(k, v) : _mm_cmpgt_epi32(v, k);
+        unsigned bits = __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(m)));
+        count += Strict ? bits : 4 - bits;
+    }
+    return count + count_scalar<Strict>(array + i, size - i, key);
+}
+
+template<bool Strict>
+__attribute__((target("sse4.2,popcnt")))
+inline unsigned count_sse42(const unsigned* array, unsigned size, unsigned key) {
+    const __m128i bias = _mm_set1_epi32(static_cast<int>(0x80000000u));
+    const __m128i k = _mm_xor_si128(_mm_set1_epi32(static_cast<int>(key)), bias);
+    unsigned i = 0, count = 0;
+    for (; i + 4 <= size; i += 4) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(array + i)), bias);
+        __m128i m = Strict ? _mm_cmpgt_epi32(k, v) : _mm_cmpgt_epi32(v, k);
+        unsigned bits = __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(m)));
+        count += Strict ? bits : 4 - bits;
+    }
+    return count + count_scalar<Strict>(array + i, size - i, key);
+}
+
+template<bool Strict>
+__attribute__((target("sse4.2,popcnt")))
+inline unsigned count_sse42(const std::uint64_t* array, unsigned size, std::uint64_t key) {
+    const __m128i bias = _mm_set1_epi64x(static_cast<long long>(0x8000000000000000ull));
+    const __m128i k = _mm_xor_si128(_mm_set1_epi64x(static_cast<long long>(key)), bias);
+    unsigned i = 0, count = 0;
+    for (; i + 2 <= size; i += 2) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(array + i)), bias);
+        __m128i m = Strict ? _mm_cmpgt_epi64(k, v) : _mm_cmpgt_epi64(v, k);
+        unsigned bits = __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(m)));
+        count += Strict ? bits : 2 - bits;
+    }
+    return count + count_scalar<Strict>(array + i, size - i, key);
+}
+
+template<bool Strict>
+__attribute__((target("sse4.2,popcnt")))
+inline unsigned count_sse42(const float* array, unsigned size, float key) {
+    const __m128 k = _mm_set1_ps(key);
+    unsigned i = 0, count = 0;
+    for (; i + 4 <= size; i += 4) {
+        __m128 v = _mm_loadu_ps(array + i);
+        __m128 m = Strict ? _mm_cmplt_ps(v, k) : _mm_cmple_ps(v, k);
+        count += __builtin_popcount(_mm_movemask_ps(m));
+    }
+    return count + count_scalar<Strict>(array + i, size - i, key);
+}
+
+template<bool Strict>
+__attribute__((target("sse4.2,popcnt")))
+inline unsigned count_sse42(const double* array, unsigned size, double key) {
+    const __m128d k = _mm_set1_pd(key);
+    unsigned i = 0, count = 0;
+    for (; i + 2 <= size; i += 2) {
+        __m128d v = _mm_loadu_pd(array + i);
+        __m128d m = Strict ? _mm_cmplt_pd(v, k) : _mm_cmple_pd(v, k);
+        count += __builtin_popcount(_mm_movemask_pd(m));
+    }
+    return count + count_scalar<Strict>(array + i, size - i, key);
+}
+
+///////////////////////// AVX2 //////////////////////////////
+
+template<bool Strict>
+__attribute__((target("avx2,popcnt")))
+inline unsigned count_avx2(const int* array, unsigned size, int key) {
+    const __m256i k = _mm256_set1_epi32(key);
+    unsigned i = 0, count = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(array + i));
+        __m256i m = Strict ? _mm256_cmpgt_epi32(k, v) : _mm256_cmpgt_epi32(v, k);
+        unsigned bits = __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+        count += Strict ? bits : 8 - bits;
+    }
+    return count + count_scalar<Strict>(array + i, size - i, key);
+}
+
+template<bool Strict>
+__attribute__((target("avx2,popcnt")))
+inline unsigned count_avx2(const unsigned* array, unsigned size, unsigned key) {
+    const __m256i bias = _mm256_set1_epi32(static_cast<int>(0x80000000u));
+    const __m256i k = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int>(key)), bias);
+    unsigned i = 0, count = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(array + i)), bias);
+        __m256i m = Strict ? _mm256_cmpgt_epi32(k, v) : _mm256_cmpgt_epi32(v, k);
+        unsigned bits = __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+        count += Strict ? bits : 8 - bits;
+    }
+    return count + count_scalar<Strict>(array + i, size - i, key);
+}
+
+template<bool Strict>
+__attribute__((target("avx2,popcnt")))
+inline unsigned count_avx2(const std::uint64_t* array, unsigned size, std::uint64_t key) {
+    const __m256i bias = _mm256_set1_epi64x(static_cast<long long>(0x8000000000000000ull));
+    const __m256i k = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<long long>(key)), bias);
+    unsigned i = 0, count = 0;
+    for (; i + 4 <= size; i += 4) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(array + i)), bias);
+        __m256i m = Strict ? _mm256_cmpgt_epi64(k, v) : _mm256_cmpgt_epi64(v, k);
+        unsigned bits = __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(m)));
+        count += Strict ? bits : 4 - bits;
+    }
+    return count + count_scalar<Strict>(array + i, size - i, key);
+}
+
+template<bool Strict>
+__attribute__((target("avx2,popcnt")))
+inline unsigned count_avx2(const float* array, unsigned size, float key) {
+    const __m256 k = _mm256_set1_ps(key);
+    unsigned i = 0, count = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m256 v = _mm256_loadu_ps(array + i);
+        __m256 m = _mm256_cmp_ps(v, k, Strict ? _CMP_LT_OQ : _CMP_LE_OQ);
+        count += __builtin_popcount(_mm256_movemask_ps(m));
+    }
+    return count + count_scalar<Strict>(array + i, size - i, key);
+}
+
+template<bool Strict>
+__attribute__((target("avx2,popcnt")))
+inline unsigned count_avx2(const double* array, unsigned size, double key) {
+    const __m256d k = _mm256_set1_pd(key);
+    unsigned i = 0, count = 0;
+    for (; i + 4 <= size; i += 4) {
+        __m256d v = _mm256_loadu_pd(array + i);
+        __m256d m = _mm256_cmp_pd(v, k, Strict ? _CMP_LT_OQ : _CMP_LE_OQ);
+        count += __builtin_popcount(_mm256_movemask_pd(m));
+    }
+    return count + count_scalar<Strict>(array + i, size - i, key);
+}
+
+///////////////////////// AVX-512 ///////////////////////////
+
+template<bool Strict>
+__attribute__((target("avx512f,popcnt")))
+inline unsigned count_avx512(const int* array, unsigned size, int key) {
+    const __m512i k = _mm512_set1_epi32(key);
+    unsigned i = 0, count = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m512i v = _mm512_loadu_si512(array + i);
+        count += __builtin_popcount(_mm512_cmp_epi32_mask(v, k, Strict ? _MM_CMPINT_LT : _MM_CMPINT_LE));
+    }
+    if (i < size) {
+        __mmask16 tail = static_cast<__mmask16>((1u << (size - i)) - 1);
+        __m512i v = _mm512_maskz_loadu_epi32(tail, array + i);
+        count += __builtin_popcount(_mm512_mask_cmp_epi32_mask(tail, v, k, Strict ? _MM_CMPINT_LT : _MM_CMPINT_LE));
+    }
+    return count;
+}
+
+template<bool Strict>
+__attribute__((target("avx512f,popcnt")))
+inline unsigned count_avx512(const unsigned* array, unsigned size, unsigned key) {
+    const __m512i k = _mm512_set1_epi32(static_cast<int>(key));
+    unsigned i = 0, count = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m512i v = _mm512_loadu_si512(array + i);
+        count += __builtin_popcount(_mm512_cmp_epu32_mask(v, k, Strict ? _MM_CMPINT_LT : _MM_CMPINT_LE));
+    }
+    if (i < size) {
+        __mmask16 tail = static_cast<__mmask16>((1u << (size - i)) - 1);
+        __m512i v = _mm512_maskz_loadu_epi32(tail, array + i);
+        count += __builtin_popcount(_mm512_mask_cmp_epu32_mask(tail, v, k, Strict ? _MM_CMPINT_LT : _MM_CMPINT_LE));
+    }
+    return count;
+}
+
+template<bool Strict>
+__attribute__((target("avx512f,popcnt")))
+inline unsigned count_avx512(const std::uint64_t* array, unsigned size, std::uint64_t key) {
+    const __m512i k = _mm512_set1_epi64(static_cast<long long>(key));
+    unsigned i = 0, count = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m512i v = _mm512_loadu_si512(array + i);
+        count += __builtin_popcount(_mm512_cmp_epu64_mask(v, k, Strict ? _MM_CMPINT_LT : _MM_CMPINT_LE));
+    }
+    if (i < size) {
+        __mmask8 tail = static_cast<__mmask8>((1u << (size - i)) - 1);
+        __m512i v = _mm512_maskz_loadu_epi64(tail, array + i);
+        count += __builtin_popcount(_mm512_mask_cmp_epu64_mask(tail, v, k, Strict ? _MM_CMPINT_LT : _MM_CMPINT_LE));
+    }
+    return count;
+}
+
+template<bool Strict>
+__attribute__((target("avx512f,popcnt")))
+inline unsigned count_avx512(const float* array, unsigned size, float key) {
+    const __m512 k = _mm512_set1_ps(key);
+    unsigned i = 0, count = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m512 v = _mm512_loadu_ps(array + i);
+        count += __builtin_popcount(_mm512_cmp_ps_mask(v, k, Strict ? _CMP_LT_OQ : _CMP_LE_OQ));
+    }
+    if (i < size) {
+        __mmask16 tail = static_cast<__mmask16>((1u << (size - i)) - 1);
+        __m512 v = _mm512_maskz_loadu_ps(tail, array + i);
+        count += __builtin_popcount(_mm512_mask_cmp_ps_mask(tail, v, k, Strict ? _CMP_LT_OQ : _CMP_LE_OQ));
+    }
+    return count;
+}
+
+template<bool Strict>
+__attribute__((target("avx512f,popcnt")))
+inline unsigned count_avx512(const double* array, unsigned size, double key) {
+    const __m512d k = _mm512_set1_pd(key);
+    unsigned i = 0, count = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m512d v = _mm512_loadu_pd(array + i);
+        count += __builtin_popcount(_mm512_cmp_pd_mask(v, k, Strict ? _CMP_LT_OQ : _CMP_LE_OQ));
+    }
+    if (i < size) {
+        __mmask8 tail = static_cast<__mmask8>((1u << (size - i)) - 1);
+        __m512d v = _mm512_maskz_loadu_pd(tail, array + i);
+        count += __builtin_popcount(_mm512_mask_cmp_pd_mask(tail, v, k, Strict ? _CMP_LT_OQ : _CMP_LE_OQ));
+    }
+    return count;
+}
+
+#endif // CDFTREE_SIMD_X86
+
+
+template<bool Strict, class T>
+inline unsigned count_window(const T* array, unsigned size, T key, Isa isa) {
+    switch (isa) {
+#if defined CDFTREE_SIMD_X86
+        case Isa::AVX512: return count_avx512<Strict>(array, size, key);
+        case Isa::AVX2:   return count_avx2<Strict>(array, size, key);
+        case Isa::SSE42:  return count_sse42<Strict>(array, size, key);
+#endif
+        default:          return count_scalar<Strict>(array, size, key);
+    }
+}
+
+template<bool Strict, class T>
+inline unsigned count(const T* array, unsigned size, T key, Isa isa) {
+    // window of two cache lines is counted directly
+    constexpr unsigned Window = 128 / sizeof(T);
+    const T* base = array;
+    while (size > Window) {
+        unsigned half = size / 2;
+        base = (Strict ? base[half] < key : base[half] <= key) ? base + half : base;
+        size -= half;
+    }
+    return static_cast<unsigned>(base - array) + count_window<Strict>(base, size, key, isa);
+}
+
+template<class T>
+inline unsigned count_less_equal(const T* array, unsigned size, T key, Isa isa = cpu_isa) {
+    return count<false>(array, size, key, isa);
+}
+
+template<class T>
+inline unsigned count_less(const T* array, unsigned size, T key, Isa isa = cpu_isa) {
+    return count<true>(array, size, key, isa);
+}
+
+} // end namespace simd
+} // end namespace utils
+
+#endif // INCLUDED_SIMD_SEARCH
@@ -0,0 +1,124 @@
+#if not defined INCLUDED_SLIDING_WINDOW_CDF_TREE
+#define INCLUDED_SLIDING_WINDOW_CDF_TREE
+
+#include <cstddef>
+#include <vector>
+#include <stdexcept>
+
+#include "cdf_tree_main.h"
+
+
+template<class Type>
+class SlidingWindowCDFTree {
+    // CDF of the last window_size inserted samples, the oldest sample
+    // is removed from the tree whenever a new one arrives into full window
+public:
+    explicit SlidingWindowCDFTree(std::size_t window_size);
+
+    // element -> probability
+    double search_PDF(Type) const;
+    unsigned search_count(Type) const;
+    // update
+    double insert_sample(Type);
+    void insert_batch(const Type* samples, std::size_t size);
+    // element -> cummulative probability
+    double search_CDF(Type e) const;
+    // cummulative proabibility -> element
+    Type inverse_search_CDF(double) const;
+    std::vector<double> search_CDF_batch(const Type* samples, std::size_t size) const;
+    std::vector<Type> inverse_search_CDF_batch(const double* probabilities, std::size_t size) const;
+
+    Type minimal_element() const;
+    Type maximal_element() const;
+
+    // samples currently inside of the window
+    std::size_t size() const { return window.size(); }
+    std::size_t window_size() const { return capacity; }
+
+    void clear();
+
+protected:
+    CDFTree<Type>       tree;
+    std::vector<Type>   window;     // ring buffer, grows up to capacity
+    std::size_t         capacity;
+    std::size_t         oldest;     // position of the oldest sample in full window
+};
+
+
+template<class Type>
+SlidingWindowCDFTree<Type>::SlidingWindowCDFTree(std::size_t window_size)
+    : capacity(window_size), oldest(0)
+{
+    if (window_size == 0)
+        throw std::runtime_error("SlidingWindowCDFTree: window size has to be positive");
+}
+
+template<class Type>
+void SlidingWindowCDFTree<Type>::clear() {
+    tree.clear();
+    window.clear();
+    oldest = 0;
+}
+
+template<class Type>
+inline double SlidingWindowCDFTree<Type>::insert_sample(Type e) {
+    if (window.size() < capacity) {
+        window.push_back(e);
+        return tree.insert_sample(e);
+    }
+
+    tree.remove_sample(window[oldest]);
+    window[oldest] = e;
+    oldest = oldest + 1 == capacity ? 0 : oldest + 1;
+    return tree.insert_sample(e);
+}
+
+template<class Type>
+void SlidingWindowCDFTree<Type>::insert_batch(const Type* samples, std::size_t size) {
+    // samples pushed out of the window by the same batch never enter the tree
+    if (size >= capacity) {
+        clear();
+        samples += size - capacity;
+        size = capacity;
+        window.assign(samples, samples + size);
+        tree.insert_batch(samples, size);
+        return;
+    }
+    for (std::size_t i = 0; i < size; ++i)
+        insert_sample(samples[i]);
+}
+
+template<class Type>
+inline double SlidingWindowCDFTree<Type>::search_PDF(Type e) const {
+    return tree.search_PDF(e);
+}
+template<class Type>
+inline unsigned SlidingWindowCDFTree<Type>::search_count(Type e) const {
+    return tree.search_count(e);
+}
+template<class Type>
+inline double SlidingWindowCDFTree<Type>::search_CDF(Type e) const {
+    return tree.search_CDF(e);
+}
+template<class Type>
+inline Type SlidingWindowCDFTree<Type>::inverse_search_CDF(double e) const {
+    return tree.inverse_search_CDF(e);
+}
+template<class Type>
+std::vector<double> SlidingWindowCDFTree<Type>::search_CDF_batch(const Type* samples, std::size_t size) const {
+    return tree.search_CDF_batch(samples, size);
+}
+template<class Type>
+std::vector<Type> SlidingWindowCDFTree<Type>::inverse_search_CDF_batch(const double* probabilities, std::size_t size) const {
+    return tree.inverse_search_CDF_batch(probabilities, size);
+}
+template<class Type>
+inline Type SlidingWindowCDFTree<Type>::minimal_element() const {
+    return tree.minimal_element();
+}
+template<class Type>
+inline Type SlidingWindowCDFTree<Type>::maximal_element() const {
+    return tree.maximal_element();
+}
+
+#endif // INCLUDED_SLIDING_WINDOW_CDF_TREE
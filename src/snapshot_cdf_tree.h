@@ -0,0 +1,202 @@
+#if not defined INCLUDED_SNAPSHOT_CDF_TREE
+#define INCLUDED_SNAPSHOT_CDF_TREE
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <stdexcept>
+#include <functional>
+#include <unordered_set>
+
+#include "cdf_tree_main.h"
+
+
+template<class Type>
+class SnapshotCDFTree {
+    // One writer thread inserts while any number of threads query without locks.
+    // Writer copies root-to-leaf paths it modifies and publishes the new root at
+    // once, so every reader sees a consistent version. Replaced pages are given
+    // back to the arena when no reader can see them anymore (epoch based reclamation).
+    // Elements are stored encoded as in CDFTree, see key_traits.h.
+    using Traits = KeyTraits<Type>;
+    using Key = typename Traits::Stored;
+    using RootNodeClusterType = RootNodeCluster<Key>;
+    static constexpr unsigned long long Idle = std::numeric_limits<unsigned long long>::max();
+
+    struct alignas(64) ReaderSlot {
+        std::atomic<unsigned long long> epoch{Idle};
+    };
+
+public:
+    static constexpr unsigned ReaderSlots = 64;
+
+    class Snapshot {
+        // pinned version of the tree, pages are not reclaimed until destruction
+    public:
+        Snapshot(Snapshot&& other) : slot(other.slot), root(other.root), counter(other.counter) {
+            other.slot = nullptr;
+        }
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+        ~Snapshot() {
+            if (slot != nullptr)
+                slot->epoch.store(Idle, std::memory_order_release);
+        }
+
+        double search_PDF(Type) const;
+        unsigned search_count(Type) const;
+        double search_CDF(Type) const;
+        Type inverse_search_CDF(double) const;
+        // number of samples in this version
+        unsigned long long size() const { return counter; }
+
+    private:
+        friend class SnapshotCDFTree;
+        Snapshot(ReaderSlot* slot, const RootNodeClusterType* root)
+            : slot(slot), root(root), counter(root->total()) {}
+
+        ReaderSlot*                 slot;
+        const RootNodeClusterType*  root;
+        unsigned long long          counter;
+    };
+
+    SnapshotCDFTree();
+    SnapshotCDFTree(const SnapshotCDFTree&) = delete;
+    SnapshotCDFTree& operator=(const SnapshotCDFTree&) = delete;
+
+    // reader side, safe from any thread
+    Snapshot snapshot() const;
+    double search_CDF(Type e) const { return snapshot().search_CDF(e); }
+    Type inverse_search_CDF(double e) const { return snapshot().inverse_search_CDF(e); }
+
+    // writer side, one thread at a time
+    void insert_sample(Type e, unsigned count = 1);
+    // whole batch becomes visible at once, paths shared by the batch are copied once
+    void insert_batch(const Type* samples, std::size_t size);
+
+    // pages waiting for readers of old versions
+    std::size_t pending_pages() const;
+
+protected:
+    RootNodeClusterType* root_at(NodeIndex index) const {
+        return arena->template at<RootNodeClusterType>(index);
+    }
+    void publish(RootNodeClusterType* root, std::vector<NodeIndex>&& retired);
+
+    std::shared_ptr<RootNodeClusterType>    origin;     // owns the arena, its page is never reused
+    NodeArena<4096>*                        arena;
+    std::atomic<NodeIndex>                  current;
+    std::atomic<unsigned long long>         epoch;
+    mutable std::array<ReaderSlot, ReaderSlots> slots;
+    // writer only, pages with epoch in which they were replaced
+    std::deque<std::pair<unsigned long long, std::vector<NodeIndex>>> retired;
+};
+
+
+template<class Type>
+SnapshotCDFTree<Type>::SnapshotCDFTree() 
+    : origin(RootNodeClusterType::factory()), arena(origin->arena), epoch(0) 
+{
+    current.store(origin->thisptr);
+}
+
+template<class Type>
+typename SnapshotCDFTree<Type>::Snapshot SnapshotCDFTree<Type>::snapshot() const {
+    // slot is announced before root is read, writer scanning slots after
+    // publication either sees the announcement or reader sees the new root
+    unsigned start = std::hash<std::thread::id>()(std::this_thread::get_id()) % ReaderSlots;
+    while (true) {
+        for (unsigned i = 0; i < ReaderSlots; ++i) {
+            ReaderSlot& slot = slots[(start + i) % ReaderSlots];
+            unsigned long long expected = Idle;
+            if (slot.epoch.load(std::memory_order_relaxed) == Idle and
+                    slot.epoch.compare_exchange_strong(expected, epoch.load()))
+                return Snapshot(&slot, root_at(current.load()));
+        }
+        std::this_thread::yield();
+    }
+}
+
+template<class Type>
+void SnapshotCDFTree<Type>::publish(RootNodeClusterType* root, std::vector<NodeIndex>&& pages) {
+    current.store(root->thisptr);
+    unsigned long long retired_epoch = epoch.fetch_add(1);
+    if (not pages.empty())
+        retired.emplace_back(retired_epoch, std::move(pages));
+
+    unsigned long long oldest = Idle;
+    for (const ReaderSlot& slot : slots)
+        oldest = std::min(oldest, slot.epoch.load());
+    while (not retired.empty() and retired.front().first < oldest) {
+        for (NodeIndex page : retired.front().second)
+            if (page != origin->thisptr)
+                arena->release(page);
+        retired.pop_front();
+    }
+}
+
+template<class Type>
+void SnapshotCDFTree<Type>::insert_sample(Type e, unsigned count) {
+    std::unordered_set<NodeIndex> copies;
+    std::vector<NodeIndex> pages;
+    Key key = Traits::encode(e);
+    RootNodeClusterType* root = root_at(current.load(std::memory_order_relaxed))->copy_path(key, copies, pages);
+    root->insert_sample(key, count);
+    publish(root, std::move(pages));
+}
+
+template<class Type>
+void SnapshotCDFTree<Type>::insert_batch(const Type* samples, std::size_t size) {
+    std::vector<Key> keys;
+    std::vector<unsigned> counts;
+    std::vector<Key> sorted = Traits::encode(std::vector<Type>(samples, samples + size));
+    utils::parallel_sort(sorted.begin(), sorted.end());
+    utils::aggregate_sorted(sorted.data(), sorted.size(), keys, counts);
+
+    std::unordered_set<NodeIndex> copies;
+    std::vector<NodeIndex> pages;
+    RootNodeClusterType* root = root_at(current.load(std::memory_order_relaxed));
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        root = root->copy_path(keys[i], copies, pages);
+        root->insert_sample(keys[i], counts[i]);
+    }
+    publish(root, std::move(pages));
+}
+
+template<class Type>
+std::size_t SnapshotCDFTree<Type>::pending_pages() const {
+    std::size_t pages = 0;
+    for (auto& r : retired)
+        pages += r.second.size();
+    return pages;
+}
+
+
+template<class Type>
+inline double SnapshotCDFTree<Type>::Snapshot::search_PDF(Type e) const {
+    return static_cast<double>(root->search_PDF(Traits::encode(e))) / counter;
+}
+template<class Type>
+inline unsigned SnapshotCDFTree<Type>::Snapshot::search_count(Type e) const {
+    return root->search_PDF(Traits::encode(e));
+}
+template<class Type>
+inline double SnapshotCDFTree<Type>::Snapshot::search_CDF(Type e) const {
+    return static_cast<double>(root->search_CDF(Traits::encode(e))) / counter;
+}
+template<class Type>
+inline Type SnapshotCDFTree<Type>::Snapshot::inverse_search_CDF(double e) const {
+    unsigned long long b = static_cast<unsigned long long>(std::ceil(e*counter));
+    if (b <= 0) {
+        throw std::runtime_error("Inversion of CDF=0 is impossible to obtain");
+    }
+    return Traits::decode(root->inverse_search_CDF(b));
+}
+
+#endif // INCLUDED_SNAPSHOT_CDF_TREE
@@ -1,10 +1,19 @@
 #include <memory>
 #include <random>
 #include <limits>
+#include <chrono>
 #include <iostream>
 
 #include "cdf_tree_main.h"
 
+template<class Function>
+double measure(Function function) {
+    auto start = std::chrono::steady_clock::now();
+    function();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
 int main () {
 
     ExternalNodeCluster<int> ena;
@@ -29,9 +38,35 @@ int main () {
             );
 
     constexpr unsigned size = 100000000; // 10**8
-    for (unsigned i = 0; i < size; ++i) {
-        //int key = distribution(key_generator);
-        int key = key_generator();
-        rna->insert_sample(key);
-    }
+    constexpr unsigned queries = 10000000; // 10**7
+
+    double t = measure([&]() {
+        for (unsigned i = 0; i < size; ++i) {
+            //int key = distribution(key_generator);
+            int key = key_generator();
+            rna->insert_sample(key);
+        }
+    });
+    std::cout << "insert_sample:      " << size / t << " ops/s" << std::endl;
+
+    unsigned long long checksum = 0;
+    t = measure([&]() {
+        for (unsigned i = 0; i < queries; ++i)
+            checksum += rna->search_PDF(key_generator());
+    });
+    std::cout << "search_PDF:         " << queries / t << " ops/s" << std::endl;
+
+    t = measure([&]() {
+        for (unsigned i = 0; i < queries; ++i)
+            checksum += rna->search_CDF(key_generator());
+    });
+    std::cout << "search_CDF:         " << queries / t << " ops/s" << std::endl;
+
+    t = measure([&]() {
+        for (unsigned i = 0; i < queries; ++i)
+            checksum += rna->inverse_search_CDF(1 + key_generator() % size);
+    });
+    std::cout << "inverse_search_CDF: " << queries / t << " ops/s" << std::endl;
+
+    std::cout << "checksum: " << checksum << std::endl;
 }
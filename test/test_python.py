@@ -29,6 +29,264 @@ def test_insert_sample_bad_input_shape():
     libcdftree.free_memory()
 
 
+def test_build_from_samples():
+    libcdftree.init_memory()
+
+    data = np.float32(np.random.randint(-50, 50, size=(10000,)))
+    libcdftree.build_from_samples(0, data)
+    libcdftree.insert_sample(1, data)
+
+    queries = np.linspace(-60, 60, num=121, dtype=np.float32)
+    built = libcdftree.sample_to_cdf(0, queries, False)
+    inserted = libcdftree.sample_to_cdf(1, queries, False)
+    for a,b in zip(built, inserted):
+        assert a == pytest.approx(b)
+
+    libcdftree.free_memory()
+
+def test_remove_sample():
+    libcdftree.init_memory()
+
+    data = np.float32(np.random.randint(-50, 50, size=(10000,)))
+    libcdftree.insert_sample(0, data)
+    libcdftree.insert_sample(1, data[:5000])
+    libcdftree.remove_sample(0, data[5000:])
+
+    queries = np.linspace(-60, 60, num=121, dtype=np.float32)
+    removed = libcdftree.sample_to_cdf(0, queries, False)
+    inserted = libcdftree.sample_to_cdf(1, queries, False)
+    for a,b in zip(removed, inserted):
+        assert a == pytest.approx(b)
+
+    with pytest.raises(RuntimeError):
+        libcdftree.remove_sample(0, np.float32([1000.]))
+
+    libcdftree.free_memory()
+
+def test_merge():
+    libcdftree.init_memory()
+
+    data = np.float32(np.random.randint(-50, 50, size=(10000,)))
+    libcdftree.insert_sample(0, data[:3000])
+    libcdftree.insert_sample(1, data[3000:])
+    libcdftree.insert_sample(2, data)
+    libcdftree.merge(0, 1)
+
+    queries = np.linspace(-60, 60, num=121, dtype=np.float32)
+    merged = libcdftree.sample_to_cdf(0, queries, False)
+    inserted = libcdftree.sample_to_cdf(2, queries, False)
+    for a,b in zip(merged, inserted):
+        assert a == pytest.approx(b)
+
+    with pytest.raises(RuntimeError):
+        libcdftree.merge(0, 5)
+
+    libcdftree.free_memory()
+
+def test_save_load(tmp_path):
+    libcdftree.init_memory()
+
+    data = np.float32(np.random.randint(-50, 50, size=(10000,)))
+    libcdftree.insert_sample(0, data)
+    path = str(tmp_path / "tree.cdf")
+    libcdftree.save(0, path)
+    libcdftree.load(1, path)
+
+    queries = np.linspace(-60, 60, num=121, dtype=np.float32)
+    saved = libcdftree.sample_to_cdf(0, queries, False)
+    loaded = libcdftree.sample_to_cdf(1, queries, False)
+    for a,b in zip(saved, loaded):
+        assert a == b
+
+    with pytest.raises(RuntimeError):
+        libcdftree.load(2, str(tmp_path / "missing.cdf"))
+
+    libcdftree.free_memory()
+
+def test_memory_budget():
+    libcdftree.init_memory()
+
+    libcdftree.set_memory_budget(0, 64 * 4096)
+    data = np.float32(np.random.normal(0, 100, size=(300000,)))
+    for part in np.split(data, 30):
+        libcdftree.insert_sample(0, part)
+
+    queries = np.linspace(-300, 300, num=61, dtype=np.float32)
+    cdf = libcdftree.sample_to_cdf(0, queries, False)
+    exact = np.searchsorted(np.sort(data), queries, side='right') / len(data)
+    assert np.max(np.abs(cdf - exact)) < 0.001
+
+    with pytest.raises(RuntimeError):
+        libcdftree.set_memory_budget(0, 100)
+
+    libcdftree.free_memory()
+
+def test_memory_limit():
+    libcdftree.init_memory()
+
+    data = np.float32(np.random.permutation(300000))
+    libcdftree.set_memory_limit(0, 64 * 4096)
+    with pytest.raises(MemoryError):
+        libcdftree.insert_sample(0, data)
+    assert libcdftree.stats(0)['allocated_bytes'] <= 64 * 4096
+
+    libcdftree.set_memory_limit(1, 64 * 4096, "approximate")
+    for part in np.split(data, 30):
+        libcdftree.insert_sample(1, part)
+    stats = libcdftree.stats(1)
+    assert stats['total'] == 300000
+    assert stats['allocated_bytes'] <= 64 * 4096
+    assert libcdftree.process_memory_usage() >= stats['allocated_bytes']
+
+    libcdftree.set_process_memory_limit(libcdftree.process_memory_usage())
+    with pytest.raises(MemoryError):
+        libcdftree.insert_sample(2, data)
+    libcdftree.set_process_memory_limit(0)
+
+    with pytest.raises(RuntimeError):
+        libcdftree.set_memory_limit(0, 4096, "drop")
+
+    libcdftree.free_memory()
+
+def test_threads():
+    import threading
+    libcdftree.init_memory()
+
+    # every thread fills its own tree while all of them query tree 0
+    shared = np.float32(np.arange(100000))
+    libcdftree.insert_sample(0, shared)
+    queries = np.float32(np.random.uniform(0, 100000, size=(50000,)))
+    expected = libcdftree.sample_to_cdf(0, queries, False)
+    failures = []
+
+    def work(index):
+        for part in np.split(np.float32(np.random.normal(0, 100, size=(100000,))), 20):
+            libcdftree.insert_sample(index, part)
+            if not np.array_equal(libcdftree.sample_to_cdf(0, queries, False), expected):
+                failures.append(index)
+
+    libcdftree.insert_sample(4, shared[:1])
+    threads = [threading.Thread(target=work, args=(i,)) for i in range(1, 5)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    assert not failures
+    for i in range(1, 4):
+        assert libcdftree.stats(i)['total'] == 100000
+    assert libcdftree.stats(4)['total'] == 100001
+
+    libcdftree.free_memory()
+
+def test_columns():
+    libcdftree.init_memory()
+
+    table = np.float32(np.random.normal(0, 100, size=(2000, 90)))
+    # strided views of row- and column-major tables, no copies made
+    for base, view in ((0, table[::2, ::3]), (30, np.asfortranarray(table)[1::2, ::3])):
+        libcdftree.insert_sample_columns(base, view)
+        for j in range(view.shape[1]):
+            assert libcdftree.stats(base + j)['total'] == view.shape[0]
+
+        cdf = libcdftree.sample_to_cdf_columns(base, view, False)
+        assert cdf.shape == view.shape
+        for j in range(view.shape[1]):
+            column = np.ascontiguousarray(view[:, j])
+            assert np.array_equal(cdf[:, j], libcdftree.sample_to_cdf(base + j, column, False))
+
+        copy = np.copy(view)
+        assert libcdftree.sample_to_cdf_columns(base, copy) is copy
+        assert np.array_equal(copy, cdf)
+
+    with pytest.raises(RuntimeError):
+        libcdftree.sample_to_cdf_columns(50, table[:, :30])
+    with pytest.raises(RuntimeError):
+        libcdftree.insert_sample_columns(0, np.float64(table))
+    with pytest.raises(RuntimeError):
+        libcdftree.insert_sample_columns(0, table[:, 0])
+    with pytest.raises(RuntimeError):
+        libcdftree.insert_sample_columns(2**31 - 10, table[:, :30])
+
+    libcdftree.free_memory()
+
+def test_tree_object():
+    trees = [libcdftree.Tree() for _ in range(1000)]
+    data = np.float32(np.random.normal(0, 100, size=(10000,)))
+    for i, tree in enumerate(trees[:10]):
+        tree.insert_sample(data[i * 1000:(i + 1) * 1000])
+    for tree in trees[1:10]:
+        trees[0].merge(tree)
+    del trees[1:]
+
+    queries = np.linspace(-300, 300, num=61, dtype=np.float32)
+    cdf = trees[0].sample_to_cdf(queries, False)
+    exact = np.searchsorted(np.sort(data), queries, side='right') / len(data)
+    assert np.max(np.abs(cdf - exact)) < 1e-6
+    assert trees[0].stats()['total'] == 10000
+
+    # methods match module functions, without index and global state
+    other = libcdftree.Tree()
+    other.build_from_samples(data)
+    probabilities = np.linspace(0.01, 1, num=100, dtype=np.float32)
+    assert np.array_equal(other.search_element_by_cdf(probabilities, False),
+                          trees[0].search_element_by_cdf(probabilities, False))
+    other.remove_sample(data[:5000])
+    assert other.stats()['total'] == 5000
+
+    with pytest.raises(TypeError):
+        other.merge(5)
+    with pytest.raises(TypeError):
+        libcdftree.Tree(3)
+
+def test_export_sorted():
+    libcdftree.init_memory()
+
+    data = np.float32(np.round(np.random.normal(0, 100, size=(100000,))))
+    libcdftree.insert_sample(0, data)
+    keys, counts = libcdftree.export_sorted(0)
+    expected_keys, expected_counts = np.unique(data, return_counts=True)
+    assert keys.dtype == np.float32 and counts.dtype == np.uint32
+    assert np.array_equal(keys, expected_keys)
+    assert np.array_equal(counts, expected_counts)
+
+    for lo, hi in ((-50, 50), (0, 0), (10, -10), (-1000, 1000)):
+        expected = np.count_nonzero((data >= lo) & (data <= hi))
+        assert libcdftree.range_count(0, lo, hi) == expected
+
+    tree = libcdftree.Tree()
+    keys, counts = tree.export_sorted()
+    assert len(keys) == 0 and len(counts) == 0
+    tree.insert_sample(data)
+    assert tree.range_count(-50, 50) == libcdftree.range_count(0, -50, 50)
+    assert np.array_equal(tree.export_sorted()[0], expected_keys)
+
+    with pytest.raises(RuntimeError):
+        libcdftree.export_sorted(5)
+
+    libcdftree.free_memory()
+
+def test_stats():
+    libcdftree.init_memory()
+
+    data = np.float32(np.arange(200000))
+    libcdftree.insert_sample(0, data)
+    libcdftree.insert_sample(0, data[:1000])
+    stats = libcdftree.stats(0)
+    assert stats['distinct'] == 200000
+    assert stats['total'] == 201000
+    assert stats['height'] == len(stats['nodes_per_level'])
+    assert stats['nodes_per_level'][0] == 1
+    assert stats['nodes_per_level'][-1] == stats['leaves']
+    assert 0 < stats['leaf_fill'] <= 1
+    assert stats['used_bytes'] == 4096 * (stats['leaves'] + stats['internal_nodes'])
+    assert stats['reserved_bytes'] >= stats['used_bytes']
+
+    with pytest.raises(RuntimeError):
+        libcdftree.stats(5)
+
+    libcdftree.free_memory()
+
 def test_samples_to_cdf():
     libcdftree.init_memory()
 
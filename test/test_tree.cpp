@@ -4,6 +4,14 @@
 
 #include <map>
 #include <random>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <numeric>
+#include <cmath>
+#include <string>
+#include <fstream>
+#include <cstdio>
 
 #define BOOST_TEST_MAIN
 #define BOOST_TEST_MODULE MyTest
@@ -11,6 +19,10 @@
 #include <boost/test/unit_test.hpp>
 
 #include "cdf_tree_main.h"
+#include "sliding_window_cdf_tree.h"
+#include "decayed_cdf_tree.h"
+#include "snapshot_cdf_tree.h"
+#include "sharded_cdf_tree.h"
 
 BOOST_AUTO_TEST_CASE( CDFTree_constructor ) {
     CDFTree<float> d;
@@ -42,6 +54,948 @@ BOOST_AUTO_TEST_CASE( CDFTree_test_all) {
 
 }
 
+BOOST_AUTO_TEST_CASE( CDFTree_build ) {
+    std::mt19937 rng(42);
+    for (unsigned size : {0u, 1u, 100u, 1000u, 300000u}) {
+        std::vector<int> samples;
+        std::map<int, unsigned> reference;
+        for (unsigned i = 0; i < size; ++i) {
+            int key = static_cast<int>(rng() % (size + 1)) - static_cast<int>(size / 2);
+            samples.push_back(key);
+            reference[key] += 1;
+        }
+
+        CDFTree<int> tree = CDFTree<int>::build(samples.begin(), samples.end());
+        unsigned cumulative = 0;
+        for (auto p : reference) {
+            cumulative += p.second;
+            BOOST_CHECK(tree.search_count(p.first) == p.second);
+            BOOST_CHECK_CLOSE(tree.search_CDF(p.first), static_cast<double>(cumulative) / size, 0.0001);
+        }
+        if (size > 0) {
+            BOOST_CHECK(tree.minimal_element() == reference.begin()->first);
+            BOOST_CHECK(tree.maximal_element() == reference.rbegin()->first);
+        }
+
+        // tree stays usable for inserts
+        for (unsigned i = 0; i < 20000; ++i) {
+            int key = static_cast<int>(rng() % 40000) - 20000;
+            tree.insert_sample(key);
+            reference[key] += 1;
+        }
+        for (auto p : reference)
+            BOOST_CHECK(tree.search_count(p.first) == p.second);
+    }
+
+    int keys[3] = {1, 5, 3};
+    unsigned counts[3] = {1, 1, 1};
+    BOOST_CHECK_THROW(CDFTree<int>::from_sorted(keys, counts, 3), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE( CDFTree_insert_batch ) {
+    std::mt19937 rng(7);
+    CDFTree<int> tree;
+    std::map<int, unsigned> reference;
+    unsigned total = 0;
+    // first batch fills empty tree, later ones hit both sparse and overflowing leaves
+    for (unsigned size : {1000u, 10u, 50000u, 200000u, 3u}) {
+        std::vector<int> samples;
+        for (unsigned i = 0; i < size; ++i) {
+            int key = static_cast<int>(rng() % 100000) - 50000;
+            samples.push_back(key);
+            reference[key] += 1;
+        }
+        tree.insert_batch(samples.data(), samples.size());
+        total += size;
+
+        unsigned cumulative = 0;
+        for (auto p : reference) {
+            cumulative += p.second;
+            BOOST_CHECK(tree.search_count(p.first) == p.second);
+            BOOST_CHECK_CLOSE(tree.search_CDF(p.first), static_cast<double>(cumulative) / total, 0.0001);
+        }
+        BOOST_CHECK(tree.minimal_element() == reference.begin()->first);
+        BOOST_CHECK(tree.maximal_element() == reference.rbegin()->first);
+    }
+
+    // sequential batch splits a single leaf into many
+    auto root = RootNodeCluster<int>::factory();
+    root->insert_sample(0);
+    std::vector<int> keys;
+    std::vector<unsigned> counts;
+    for (int i = 1; i < 100000; ++i) {
+        keys.push_back(i);
+        counts.push_back(2);
+    }
+    root->insert_sorted(keys.data(), counts.data(), keys.size());
+    root->sanity_check();
+    for (int i = 1; i < 100000; ++i)
+        BOOST_CHECK(root->search_CDF(i) == 1 + 2ull * i);
+}
+
+BOOST_AUTO_TEST_CASE( CDFTree_batch_queries ) {
+    std::mt19937 rng(11);
+    CDFTree<int> tree;
+    std::vector<double> empty = tree.search_CDF_batch(nullptr, 0);
+    BOOST_CHECK(empty.empty());
+
+    for (unsigned i = 0; i < 100000; ++i)
+        tree.insert_sample(static_cast<int>(rng() % 30000));
+
+    // unsorted queries with duplicates, sparse and dense runs inside of leaves
+    std::vector<int> samples;
+    for (unsigned i = 0; i < 5000; ++i)
+        samples.push_back(static_cast<int>(rng() % 32000) - 1000);
+    for (int i = 100; i < 3000; ++i)
+        samples.push_back(i);
+    std::vector<double> cdf = tree.search_CDF_batch(samples.data(), samples.size());
+    BOOST_REQUIRE(cdf.size() == samples.size());
+    for (unsigned i = 0; i < samples.size(); ++i)
+        BOOST_CHECK(cdf[i] == tree.search_CDF(samples[i]));
+
+    std::vector<double> probabilities;
+    for (unsigned i = 0; i < 5000; ++i)
+        probabilities.push_back((1 + rng() % 100000) / 100000.);
+    probabilities.push_back(1.);
+    std::vector<int> elements = tree.inverse_search_CDF_batch(probabilities.data(), probabilities.size());
+    BOOST_REQUIRE(elements.size() == probabilities.size());
+    for (unsigned i = 0; i < probabilities.size(); ++i)
+        BOOST_CHECK(elements[i] == tree.inverse_search_CDF(probabilities[i]));
+
+    // large batches are split between threads
+    samples.clear();
+    probabilities.clear();
+    for (unsigned i = 0; i < 200000; ++i) {
+        samples.push_back(static_cast<int>(rng() % 32000) - 1000);
+        probabilities.push_back((1 + rng() % 100000) / 100000.);
+    }
+    cdf = tree.search_CDF_batch(samples.data(), samples.size());
+    elements = tree.inverse_search_CDF_batch(probabilities.data(), probabilities.size());
+    for (unsigned i = 0; i < samples.size(); i += 7) {
+        BOOST_CHECK(cdf[i] == tree.search_CDF(samples[i]));
+        BOOST_CHECK(elements[i] == tree.inverse_search_CDF(probabilities[i]));
+    }
+    // single thread gives the same answers
+    BOOST_CHECK(tree.search_CDF_batch(samples.data(), samples.size(), 1) == cdf);
+    BOOST_CHECK(tree.inverse_search_CDF_batch(probabilities.data(), probabilities.size(), 1) == elements);
+
+    for (double bad : {0., 1.5, -0.5, std::nan("")}) {
+        probabilities.back() = bad;
+        BOOST_CHECK_THROW(tree.inverse_search_CDF_batch(probabilities.data(), probabilities.size()), std::runtime_error);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( remove_sample ) {
+    std::mt19937 rng(3);
+    auto root = RootNodeCluster<int>::factory();
+    std::map<int, unsigned> reference;
+    for (unsigned i = 0; i < 300000; ++i) {
+        int key = static_cast<int>(rng() % 100000);
+        root->insert_sample(key);
+        reference[key] += 1;
+    }
+    BOOST_CHECK_THROW(root->remove_sample(-1), std::runtime_error);
+    BOOST_CHECK_THROW(root->remove_sample(reference.begin()->first, reference.begin()->second + 1), std::runtime_error);
+
+    // random removals shrink the tree through merges and borrows down to a single leaf
+    std::vector<int> keys;
+    for (auto p : reference)
+        keys.push_back(p.first);
+    std::shuffle(keys.begin(), keys.end(), rng);
+    for (unsigned i = 0; i < keys.size(); ++i) {
+        int key = keys[i];
+        unsigned count = reference[key] > 1 and i % 2 ? 1 : reference[key];
+        BOOST_CHECK(root->remove_sample(key, count) == reference[key] - count);
+        reference[key] -= count;
+        if (reference[key] == 0)
+            reference.erase(key);
+
+        if (i % 5000 == 0 or keys.size() - i < 600) {
+            root->sanity_check();
+            unsigned long long cumulative = 0;
+            for (auto p : reference) {
+                cumulative += p.second;
+                BOOST_CHECK(root->search_CDF(p.first) == cumulative);
+            }
+        }
+    }
+    for (auto p : reference)
+        root->remove_sample(p.first, p.second);
+    BOOST_CHECK(root->search_CDF(100000) == 0);
+    BOOST_CHECK_THROW(root->inverse_search_CDF(1), std::runtime_error);
+
+    // emptied tree is usable again
+    root->insert_sample(5, 2);
+    root->sanity_check();
+    BOOST_CHECK(root->search_PDF(5) == 2);
+
+    CDFTree<int> tree;
+    tree.insert_sample(1);
+    tree.insert_sample(2, 3);
+    BOOST_CHECK_CLOSE(tree.remove_sample(2), 2. / 3., 0.0001);
+    BOOST_CHECK_CLOSE(tree.search_CDF(1), 1. / 3., 0.0001);
+}
+
+BOOST_AUTO_TEST_CASE( sliding_window ) {
+    BOOST_CHECK_THROW(SlidingWindowCDFTree<int>(0), std::runtime_error);
+
+    std::mt19937 rng(5);
+    constexpr unsigned window = 2000;
+    SlidingWindowCDFTree<int> tree(window);
+    std::vector<int> samples;
+    for (unsigned i = 0; i < 20000; ++i) {
+        int key = static_cast<int>(rng() % 3000);
+        samples.push_back(key);
+        tree.insert_sample(key);
+        BOOST_CHECK(tree.size() == std::min<std::size_t>(samples.size(), window));
+
+        if (i % 1000 == 999 or i == 10) {
+            std::map<int, unsigned> reference;
+            std::size_t first = samples.size() - tree.size();
+            for (std::size_t j = first; j < samples.size(); ++j)
+                reference[samples[j]] += 1;
+            unsigned cumulative = 0;
+            for (auto p : reference) {
+                cumulative += p.second;
+                BOOST_CHECK(tree.search_count(p.first) == p.second);
+                BOOST_CHECK_CLOSE(tree.search_CDF(p.first), static_cast<double>(cumulative) / tree.size(), 0.0001);
+            }
+            BOOST_CHECK(tree.minimal_element() == reference.begin()->first);
+            BOOST_CHECK(tree.inverse_search_CDF(1.) == reference.rbegin()->first);
+        }
+    }
+
+    // batch longer than window keeps only its tail
+    tree.insert_batch(samples.data(), samples.size());
+    BOOST_CHECK(tree.size() == window);
+    tree.insert_sample(-1);
+    BOOST_CHECK(tree.search_count(-1) == 1);
+    BOOST_CHECK(tree.search_count(samples[samples.size() - window]) == 
+            std::count(samples.end() - window + 1, samples.end(), samples[samples.size() - window]));
+}
+
+BOOST_AUTO_TEST_CASE( decayed_cdf ) {
+    BOOST_CHECK_THROW(DecayedCDFTree<int>(0.), std::runtime_error);
+    BOOST_CHECK_THROW(DecayedCDFTree<int>(1.5), std::runtime_error);
+
+    DecayedCDFTree<int> small(0.5);
+    small.insert_sample(1);
+    small.insert_sample(2);
+    small.insert_sample(3);
+    BOOST_CHECK_CLOSE(small.search_CDF(1), 1. / 7., 0.0001);
+    BOOST_CHECK_CLOSE(small.search_CDF(2), 3. / 7., 0.0001);
+    BOOST_CHECK_CLOSE(small.search_PDF(3), 4. / 7., 0.0001);
+    BOOST_CHECK_CLOSE(small.total_weight(), 1.75, 0.0001);
+    BOOST_CHECK(small.inverse_search_CDF(0.5) == 3);
+    BOOST_CHECK(small.inverse_search_CDF(1.) == 3);
+
+    // long stream goes through renormalizations, oldest unique key is forgotten
+    constexpr double decay = 0.95;
+    std::mt19937 rng(9);
+    DecayedCDFTree<int> tree(decay);
+    std::vector<int> samples;
+    tree.insert_sample(-1);
+    samples.push_back(-1);
+    for (unsigned i = 0; i < 20000; ++i) {
+        int key = static_cast<int>(rng() % 100);
+        tree.insert_sample(key);
+        samples.push_back(key);
+    }
+    std::map<int, double> reference;
+    double weight = 1., total = 0.;
+    for (auto it = samples.rbegin(); it != samples.rend(); ++it) {
+        reference[*it] += weight;
+        total += weight;
+        weight *= decay;
+    }
+    double cumulative = 0.;
+    for (auto p : reference) {
+        cumulative += p.second;
+        if (p.first >= 0)
+            BOOST_CHECK_CLOSE(tree.search_CDF(p.first), cumulative / total, 1e-6);
+    }
+    BOOST_CHECK(tree.search_PDF(-1) == 0.);
+    BOOST_CHECK(tree.minimal_element() >= 0);
+    BOOST_CHECK_CLOSE(tree.total_weight(), total, 1e-6);
+    BOOST_CHECK(tree.inverse_search_CDF(1.) == tree.maximal_element());
+}
+
+BOOST_AUTO_TEST_CASE( snapshot_readers ) {
+    // writer inserts 0, 1, 2, ... so every consistent version of n samples
+    // has CDF(x) = (x+1)/n for x < n
+    constexpr unsigned samples = 100000;
+    SnapshotCDFTree<int> tree;
+    std::atomic<bool> done(false);
+    std::atomic<unsigned> failures(0), checked(0);
+
+    auto reader = [&](unsigned seed) {
+        std::mt19937 rng(seed);
+        while (not done.load()) {
+            auto snapshot = tree.snapshot();
+            unsigned long long n = snapshot.size();
+            if (n == 0)
+                continue;
+            for (unsigned i = 0; i < 20; ++i) {
+                int x = static_cast<int>(rng() % n);
+                if (snapshot.search_CDF(x) != static_cast<double>(x + 1) / n)
+                    failures += 1;
+                if (snapshot.inverse_search_CDF((x + 0.5) / n) != x)
+                    failures += 1;
+            }
+            if (snapshot.search_count(static_cast<int>(n)) != 0)
+                failures += 1;
+            checked += 1;
+        }
+    };
+    std::vector<std::thread> readers;
+    for (unsigned t = 0; t < 3; ++t)
+        readers.emplace_back(reader, t);
+
+    for (int i = 0; i < static_cast<int>(samples) / 2; ++i)
+        tree.insert_sample(i);
+    std::vector<int> batch;
+    for (int i = samples / 2; i < static_cast<int>(samples); ++i) {
+        batch.push_back(i);
+        if (batch.size() == 1000) {
+            tree.insert_batch(batch.data(), batch.size());
+            batch.clear();
+        }
+    }
+    done = true;
+    for (auto& r : readers)
+        r.join();
+
+    BOOST_CHECK(failures == 0);
+    BOOST_CHECK(checked > 0);
+    BOOST_CHECK_CLOSE(tree.search_CDF(samples / 4 - 1), 0.25, 0.0001);
+    BOOST_CHECK(tree.inverse_search_CDF(0.5) == samples / 2 - 1);
+
+    // without readers old pages are given back right away
+    tree.insert_sample(0);
+    BOOST_CHECK(tree.pending_pages() == 0);
+}
+
+BOOST_AUTO_TEST_CASE( sharded_tree ) {
+    BOOST_CHECK_THROW(ShardedCDFTree<int>(0), std::runtime_error);
+
+    constexpr unsigned shards = 4, per_shard = 30000;
+    ShardedCDFTree<int> sharded(shards);
+    std::vector<std::vector<int>> samples(shards);
+    std::mt19937 rng(13);
+    for (unsigned s = 0; s < shards; ++s)
+        for (unsigned i = 0; i < per_shard; ++i)
+            // shards see differently shifted data
+            samples[s].push_back(static_cast<int>(rng() % 20000) + 3000 * static_cast<int>(s));
+
+    std::vector<std::thread> workers;
+    for (unsigned s = 0; s < shards; ++s)
+        workers.emplace_back([&, s]() {
+            for (int key : samples[s])
+                sharded.insert_sample(s, key);
+        });
+    for (auto& w : workers)
+        w.join();
+
+    CDFTree<int> reference;
+    for (auto& shard : samples)
+        for (int key : shard)
+            reference.insert_sample(key);
+
+    BOOST_CHECK(sharded.size() == shards * per_shard);
+    BOOST_CHECK(sharded.minimal_element() == reference.minimal_element());
+    BOOST_CHECK(sharded.maximal_element() == reference.maximal_element());
+    for (int key = -10; key < 30000; key += 37) {
+        BOOST_CHECK(sharded.search_count(key) == reference.search_count(key));
+        BOOST_CHECK(sharded.search_CDF(key) == reference.search_CDF(key));
+    }
+    for (unsigned i = 0; i < 500; ++i) {
+        double e = (1 + rng() % 1000000) / 1000000.;
+        BOOST_CHECK(sharded.inverse_search_CDF(e) == reference.inverse_search_CDF(e));
+    }
+    BOOST_CHECK(sharded.inverse_search_CDF(1.) == reference.maximal_element());
+
+    // batch split among shards
+    ShardedCDFTree<int> batched(3);
+    batched.insert_batch(samples[0].data(), samples[0].size());
+    BOOST_CHECK(batched.size() == per_shard);
+    std::vector<int> sorted = samples[0];
+    std::sort(sorted.begin(), sorted.end());
+    for (unsigned i = 0; i < 300; ++i) {
+        unsigned rank = 1 + rng() % per_shard;
+        BOOST_CHECK(batched.inverse_search_CDF((rank - 0.5) / per_shard) == sorted[rank - 1]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( CDFTree_merge ) {
+    std::mt19937 rng(17);
+    std::vector<CDFTree<int>> trees(4);
+    CDFTree<int> reference;
+    // overlapping and disjoint key ranges, last tree stays empty
+    for (unsigned t = 0; t < 3; ++t)
+        for (unsigned i = 0; i < 50000; ++i) {
+            int key = static_cast<int>(rng() % 40000) + 30000 * static_cast<int>(t);
+            trees[t].insert_sample(key);
+            reference.insert_sample(key);
+        }
+    unsigned count_in_last = trees[2].search_count(70000);
+    double cdf_in_last = trees[2].search_CDF(75000);
+
+    CDFTree<int> merged = CDFTree<int>::merge({&trees[0], &trees[1], &trees[2], &trees[3]});
+    for (int key = -5; key < 110000; key += 13) {
+        BOOST_CHECK(merged.search_count(key) == reference.search_count(key));
+        BOOST_CHECK(merged.search_CDF(key) == reference.search_CDF(key));
+    }
+
+    trees[0].merge(trees[1]);
+    trees[0].merge(trees[3]);
+    trees[0].merge(trees[2]);
+    for (int key = -5; key < 110000; key += 13)
+        BOOST_CHECK(trees[0].search_count(key) == reference.search_count(key));
+    trees[0].insert_sample(-7);
+    BOOST_CHECK(trees[0].minimal_element() == -7);
+
+    // merging with itself doubles every count
+    trees[2].merge(trees[2]);
+    BOOST_CHECK(trees[2].search_count(70000) == 2 * count_in_last);
+    BOOST_CHECK(trees[2].search_CDF(75000) == cdf_in_last);
+
+    // count of a key past the counter width is refused, tree is kept
+    CDFTree<int> heavy;
+    heavy.insert_sample(5, std::numeric_limits<unsigned>::max() - 10);
+    heavy.insert_sample(6);
+    BOOST_CHECK_THROW(heavy.merge(heavy), std::runtime_error);
+    BOOST_CHECK(heavy.search_count(5) == std::numeric_limits<unsigned>::max() - 10);
+}
+
+BOOST_AUTO_TEST_CASE( save_load ) {
+    const std::string path = "/tmp/cdf_tree_test_save_load.cdf";
+    std::mt19937 rng(23);
+    CDFTree<float> tree;
+    for (unsigned i = 0; i < 100000; ++i)
+        tree.insert_sample(static_cast<float>(rng() % 20000) / 4.f - 1000.f);
+    tree.save(path);
+
+    CDFTree<float> loaded = CDFTree<float>::load(path);
+    MappedCDFTree<float> mapped(path);
+    BOOST_CHECK_NO_THROW(mapped.verify());
+    BOOST_CHECK(mapped.size() == 100000);
+    BOOST_CHECK(mapped.minimal_element() == tree.minimal_element());
+    BOOST_CHECK(mapped.maximal_element() == tree.maximal_element());
+    for (float key = -1002.f; key < 4002.f; key += 0.75f) {
+        BOOST_CHECK(loaded.search_count(key) == tree.search_count(key));
+        BOOST_CHECK(loaded.search_CDF(key) == tree.search_CDF(key));
+        BOOST_CHECK(mapped.search_count(key) == tree.search_count(key));
+        BOOST_CHECK(mapped.search_CDF(key) == tree.search_CDF(key));
+    }
+    for (double p = 0.0005; p <= 1.; p += 0.001) {
+        BOOST_CHECK(loaded.inverse_search_CDF(p) == tree.inverse_search_CDF(p));
+        BOOST_CHECK(mapped.inverse_search_CDF(p) == tree.inverse_search_CDF(p));
+    }
+
+    // element without samples (cumulative equal to the previous one)
+    CDFTree<float>::build({1.f, 2.f, 2.f, 3.f}).save(path);
+    {
+        using Record = CDFTreeFileRecord<float>;
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        Record records[2];
+        file.seekg(sizeof(CDFTreeFileHeader));
+        file.read(reinterpret_cast<char*>(records), sizeof(records));
+        records[1].cumulative = records[0].cumulative;
+        file.seekp(sizeof(CDFTreeFileHeader));
+        file.write(reinterpret_cast<const char*>(records), sizeof(records));
+    }
+    BOOST_CHECK_THROW(CDFTree<float>::load(path), std::runtime_error);
+    // mapping reads only the last record, full check is explicit
+    MappedCDFTree<float> damaged(path);
+    BOOST_CHECK_THROW(damaged.verify(), std::runtime_error);
+
+    // elements out of order
+    CDFTree<float>::build({1.f, 2.f, 3.f}).save(path);
+    {
+        using Record = CDFTreeFileRecord<float>;
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        Record record;
+        file.seekg(sizeof(CDFTreeFileHeader));
+        file.read(reinterpret_cast<char*>(&record), sizeof(record));
+        record.element = 5.f;
+        file.seekp(sizeof(CDFTreeFileHeader));
+        file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    }
+    BOOST_CHECK_THROW(CDFTree<float>::load(path), std::runtime_error);
+    BOOST_CHECK_THROW(MappedCDFTree<float>(path).verify(), std::runtime_error);
+
+    // empty tree, wrong element type, not a tree file
+    CDFTree<float>().save(path);
+    BOOST_CHECK(MappedCDFTree<float>(path).size() == 0);
+    BOOST_CHECK_THROW(CDFTree<int>::load(path), std::runtime_error);
+    BOOST_CHECK_THROW(MappedCDFTree<double> wrong(path), std::runtime_error);
+    std::ofstream(path) << "certainly not a tree";
+    BOOST_CHECK_THROW(CDFTree<float>::load(path), std::runtime_error);
+    BOOST_CHECK_THROW(MappedCDFTree<float> wrong(path), std::runtime_error);
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE( frozen_tree ) {
+    std::mt19937 rng(29);
+    // sizes of full and partial last level of the implicit tree
+    for (unsigned size : {1u, 2u, 7u, 8u, 1000u, 100000u}) {
+        CDFTree<int> tree;
+        for (unsigned i = 0; i < size; ++i)
+            tree.insert_sample(static_cast<int>(rng() % (2 * size)), 1 + rng() % 3);
+        FrozenCDFTree<int> frozen = tree.freeze();
+
+        BOOST_CHECK(frozen.minimal_element() == tree.minimal_element());
+        BOOST_CHECK(frozen.maximal_element() == tree.maximal_element());
+        std::vector<int> keys;
+        for (int key = -2; key < static_cast<int>(2 * size) + 2; ++key) {
+            keys.push_back(key);
+            BOOST_CHECK(frozen.search_count(key) == tree.search_count(key));
+            BOOST_CHECK(frozen.search_PDF(key) == tree.search_PDF(key));
+            BOOST_CHECK(frozen.search_CDF(key) == tree.search_CDF(key));
+        }
+        BOOST_CHECK(frozen.search_CDF_batch(keys.data(), keys.size()) == tree.search_CDF_batch(keys.data(), keys.size()));
+
+        std::vector<double> probabilities;
+        for (unsigned i = 0; i < 2000; ++i)
+            probabilities.push_back((1 + rng() % 100000) / 100000.);
+        probabilities.push_back(1.);
+        for (double p : probabilities)
+            BOOST_CHECK(frozen.inverse_search_CDF(p) == tree.inverse_search_CDF(p));
+        BOOST_CHECK(frozen.inverse_search_CDF_batch(probabilities.data(), probabilities.size()) ==
+                    tree.inverse_search_CDF_batch(probabilities.data(), probabilities.size()));
+        BOOST_CHECK_THROW(frozen.inverse_search_CDF(0.), std::runtime_error);
+    }
+
+    FrozenCDFTree<float> empty = CDFTree<float>().freeze();
+    BOOST_CHECK(empty.size() == 0);
+    BOOST_CHECK_THROW(empty.minimal_element(), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE( memory_budget ) {
+    std::mt19937 rng(31);
+    std::normal_distribution<float> normal(0.f, 100.f);
+    const std::size_t budget = 64 * 4096;
+    CDFTree<float> tree;
+    tree.set_memory_budget(budget);
+    BOOST_CHECK_THROW(tree.set_memory_budget(4096), std::runtime_error);
+
+    // almost every sample is a distinct element
+    std::vector<float> samples;
+    for (unsigned i = 0; i < 500000; ++i) {
+        samples.push_back(normal(rng));
+        tree.insert_sample(samples.back());
+    }
+    std::vector<float> batch;
+    for (unsigned i = 0; i < 200000; ++i)
+        batch.push_back(normal(rng));
+    tree.insert_batch(batch.data(), batch.size());
+    samples.insert(samples.end(), batch.begin(), batch.end());
+    std::sort(samples.begin(), samples.end());
+
+    unsigned distinct = 0;
+    tree.for_each([&](float, unsigned) { ++distinct; });
+    BOOST_CHECK(distinct < budget / 4096 * 512);
+    BOOST_CHECK(tree.rank_error() > 0.);
+    // bound sums errors of all compactions that ran
+    BOOST_CHECK(tree.rank_error() < 0.002);
+    double worst = 0.;
+    for (float e = -500.f; e < 500.f; e += 0.37f) {
+        double exact = static_cast<double>(std::upper_bound(samples.begin(), samples.end(), e) - samples.begin()) / samples.size();
+        worst = std::max(worst, std::abs(tree.search_CDF(e) - exact));
+    }
+    BOOST_CHECK(worst <= tree.rank_error());
+    BOOST_CHECK(tree.minimal_element() >= samples.front());
+    BOOST_CHECK(tree.maximal_element() <= samples.back());
+
+    // integer elements use weighted median, explicit compaction
+    CDFTree<int> integers;
+    for (int i = 0; i < 10000; ++i)
+        integers.insert_sample(i);
+    integers.compact(100);
+    distinct = 0;
+    integers.for_each([&](int, unsigned) { ++distinct; });
+    BOOST_CHECK(distinct <= 101);
+    BOOST_CHECK(integers.rank_error() <= 0.02 + 1e-9);
+    for (int i = 0; i < 10000; i += 7)
+        BOOST_CHECK(std::abs(integers.search_CDF(i) - (i + 1) / 10000.) <= integers.rank_error());
+
+    // budget survives merge and clear
+    tree.merge(tree);
+    BOOST_CHECK(tree.memory_budget() == budget);
+    tree.clear();
+    BOOST_CHECK(tree.memory_budget() == budget);
+    BOOST_CHECK(tree.rank_error() == 0.);
+}
+
+BOOST_AUTO_TEST_CASE( memory_limit ) {
+    MemoryRegistry& registry = MemoryRegistry::instance();
+    const std::size_t before = registry.allocated();
+    const std::size_t limit = 256 * 1024;
+    std::mt19937 rng(37);
+    std::vector<int> order(200000);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), rng);
+
+    // rejected insert leaves the tree unchanged and within its limit
+    std::size_t rejected = 0;
+    {
+        CDFTree<int> tree;
+        tree.set_memory_limit(limit);
+        BOOST_CHECK(registry.allocated() == before + tree.memory_usage());
+        try {
+            for (; rejected < order.size(); ++rejected)
+                tree.insert_sample(order[rejected]);
+        } catch (MemoryLimitError&) {
+        }
+        BOOST_CHECK(rejected < order.size());
+        BOOST_CHECK(tree.memory_usage() <= limit);
+        BOOST_CHECK(registry.allocated() == before + tree.memory_usage());
+        BOOST_CHECK(tree.search_count(order[rejected]) == 0);
+        unsigned long long total = 0;
+        tree.for_each([&](int, unsigned count) { total += count; });
+        BOOST_CHECK(total == rejected);
+        BOOST_CHECK(tree.search_CDF(tree.maximal_element()) == 1.);
+        // existing elements fit without new pages
+        BOOST_CHECK_NO_THROW(tree.insert_sample(order[0], 5));
+        BOOST_CHECK(tree.search_count(order[0]) == 6);
+
+        // batch keeps chunks inserted before the limit was hit
+        std::vector<int> batch(order.begin() + rejected, order.end());
+        BOOST_CHECK_THROW(tree.insert_batch(batch), MemoryLimitError);
+        BOOST_CHECK(tree.memory_usage() <= limit);
+        total = 0;
+        tree.for_each([&](int, unsigned count) { total += count; });
+        BOOST_CHECK(tree.search_CDF(tree.maximal_element()) == 1.);
+        BOOST_CHECK(std::abs(tree.search_PDF(order[0]) - 6. / total) < 1e-12);
+    }
+    BOOST_CHECK(registry.allocated() == before);
+
+    // repacking makes room for more elements, limit survives clear
+    {
+        CDFTree<int> tree;
+        tree.set_memory_limit(limit, MemoryPolicy::Compact);
+        std::size_t inserted = 0;
+        try {
+            for (; inserted < order.size(); ++inserted)
+                tree.insert_sample(order[inserted]);
+        } catch (MemoryLimitError&) {
+        }
+        BOOST_CHECK(inserted > rejected);
+        BOOST_CHECK(tree.memory_usage() <= limit);
+        for (std::size_t i = 0; i < inserted; i += 97)
+            BOOST_CHECK(tree.search_count(order[i]) == 1);
+        tree.clear();
+        BOOST_CHECK(tree.memory_limit() == limit);
+        BOOST_CHECK(tree.memory_policy() == MemoryPolicy::Compact);
+    }
+
+    // approximation never fails, the error stays bounded
+    {
+        CDFTree<int> tree;
+        tree.set_memory_limit(limit, MemoryPolicy::Approximate);
+        for (int e : order)
+            tree.insert_sample(e);
+        tree.insert_batch(order);
+        BOOST_CHECK(tree.memory_usage() <= limit);
+        BOOST_CHECK(tree.rank_error() > 0.);
+        BOOST_CHECK(tree.rank_error() < 0.01);
+        for (int e = 0; e < 200000; e += 1013)
+            BOOST_CHECK(std::abs(tree.search_CDF(e) - (e + 1) / 200000.) <= tree.rank_error());
+    }
+
+    // process-wide limit applies to trees without their own
+    registry.set_limit(registry.allocated() + limit);
+    {
+        CDFTree<int> tree;
+        BOOST_CHECK_THROW(tree.insert_batch(order), MemoryLimitError);
+        BOOST_CHECK(registry.allocated() <= registry.limit());
+    }
+    registry.set_limit(0);
+    BOOST_CHECK(registry.allocated() == before);
+}
+
+BOOST_AUTO_TEST_CASE( widened_leaf_pages ) {
+    // full leaf spreads over several pieces when its counts get 4 bytes wide
+    using Leaf = ExternalNodeCluster<int, 4096>;
+    std::vector<int> keys;
+    for (unsigned i = 0; i + 1 < Leaf::capacity_for(1); ++i)
+        keys.push_back(static_cast<int>(2 * i));
+    std::vector<unsigned> counts(keys.size(), 1);
+    auto root = RootNodeCluster<int>::factory();
+    root->bulk_load(keys.data(), counts.data(), keys.size());
+    BOOST_REQUIRE(root->stats().leaves == 1);
+
+    std::size_t pages = root->stats().leaves + root->stats().internal_nodes;
+    std::size_t estimate = root->pages_for_insert(1, 1u << 20);
+    root->insert_sample(1, 1u << 20);
+    root->sanity_check();
+    BOOST_CHECK(root->stats().leaves > 1);
+    BOOST_CHECK(root->stats().leaves + root->stats().internal_nodes - pages <= estimate);
+}
+
+BOOST_AUTO_TEST_CASE( bulk_load ) {
+    for (unsigned size : {1u, 491u, 492u, 5000u, 200000u}) {
+        std::vector<int> keys;
+        std::vector<unsigned> counts;
+        for (unsigned i = 0; i < size; ++i) {
+            keys.push_back(3 * i);
+            counts.push_back(1 + i % 5);
+        }
+        auto root = RootNodeCluster<int>::factory();
+        root->bulk_load(keys.data(), counts.data(), size);
+        root->sanity_check();
+
+        unsigned long long cdf = 0;
+        for (unsigned i = 0; i < size; ++i) {
+            cdf += counts[i];
+            BOOST_CHECK(root->search_PDF(keys[i]) == counts[i]);
+            BOOST_CHECK(root->search_CDF(keys[i]) == cdf);
+            BOOST_CHECK(root->inverse_search_CDF(cdf) == keys[i]);
+        }
+        for (unsigned i = 0; i < size; ++i)
+            root->insert_sample(3 * i + 1);
+        root->sanity_check();
+    }
+}
+
+BOOST_AUTO_TEST_CASE( leaf_links ) {
+    auto root = RootNodeCluster<int>::factory();
+    BOOST_CHECK(root->begin() == root->end());
+    BOOST_CHECK(root->range_count(0, 10) == 0);
+
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<int> dist(0, 100000);
+    std::map<int, unsigned> expected;
+    for (int i = 0; i < 200000; ++i) {
+        int e = dist(gen);
+        root->insert_sample(e, 1 + e % 3);
+        expected[e] += 1 + e % 3;
+    }
+    // removals merge and rebalance leaves
+    for (int e = 0; e < 90000; ++e)
+        if (expected.count(e)) {
+            root->remove_sample(e, expected[e]);
+            expected.erase(e);
+        }
+    root->sanity_check();
+
+    std::vector<std::pair<int, unsigned>> visited(root->begin(), root->end());
+    std::vector<std::pair<int, unsigned>> sorted(expected.begin(), expected.end());
+    BOOST_CHECK(visited == sorted);
+    BOOST_CHECK(root->distinct() == expected.size());
+    BOOST_CHECK((*root->lower_bound(95000)).first == expected.lower_bound(95000)->first);
+    BOOST_CHECK(root->lower_bound(100001) == root->end());
+
+    std::vector<int> keys(root->distinct());
+    std::vector<unsigned> counts(keys.size());
+    root->export_to(keys.data(), counts.data());
+    for (std::size_t i = 0; i < keys.size(); ++i)
+        BOOST_CHECK(keys[i] == visited[i].first and counts[i] == visited[i].second);
+
+    for (int i = 0; i < 1000; ++i) {
+        int lo = dist(gen), hi = dist(gen);
+        unsigned long long count = hi < lo ? 0 : root->search_CDF(hi) - root->search_CDF(lo - 1);
+        BOOST_CHECK(root->range_count(lo, hi) == count);
+    }
+    BOOST_CHECK(root->range_count(0, 100000) == root->total());
+    BOOST_CHECK(root->range_count(keys[5], keys[5]) == counts[5]);
+
+    // packed trees are linked as well
+    auto packed = RootNodeCluster<int>::factory();
+    packed->bulk_load(keys.data(), counts.data(), keys.size());
+    packed->sanity_check();
+    BOOST_CHECK(std::equal(packed->begin(), packed->end(), root->begin(), root->end()));
+
+    CDFTree<float> tree = CDFTree<float>::build({-2.f, 0.5f, 0.5f, 3.f});
+    std::vector<float> elements(tree.distinct());
+    std::vector<unsigned> numbers(elements.size());
+    tree.export_to(elements.data(), numbers.data());
+    BOOST_CHECK(elements == std::vector<float>({-2.f, 0.5f, 3.f}));
+    BOOST_CHECK(numbers == std::vector<unsigned>({1, 2, 1}));
+    BOOST_CHECK(tree.range_count(-2.f, 0.5f) == 3);
+    BOOST_CHECK(tree.range_count(0.f, 10.f) == 3);
+}
+
+BOOST_AUTO_TEST_CASE( compact_counts ) {
+    using Leaf = ExternalNodeCluster<int>;
+    BOOST_CHECK(Leaf::capacity_for(1) > Leaf::capacity_for(2));
+    BOOST_CHECK(Leaf::capacity_for(2) > Leaf::capacity_for(4));
+
+    // low counts fit more elements per page
+    const unsigned size = 100000;
+    std::vector<int> keys;
+    std::vector<unsigned> low, high;
+    for (unsigned i = 0; i < size; ++i) {
+        keys.push_back(2 * i);
+        low.push_back(1 + i % 7);
+        high.push_back(100000 + i);
+    }
+    auto narrow = RootNodeCluster<int>::factory();
+    narrow->bulk_load(keys.data(), low.data(), size);
+    auto wide = RootNodeCluster<int>::factory();
+    wide->bulk_load(keys.data(), high.data(), size);
+    narrow->sanity_check();
+    wide->sanity_check();
+    BOOST_CHECK(narrow->used_bytes() * 3 < wide->used_bytes() * 2);
+
+    // leaves are promoted when counts grow, narrow ones split earlier
+    unsigned long long total = narrow->total();
+    for (unsigned i = 0; i < size; i += 97) {
+        unsigned number = i % 2 ? 300 : 70000;
+        narrow->insert_sample(keys[i], number);
+        low[i] += number;
+        total += number;
+    }
+    for (unsigned i = 0; i < size; ++i)
+        narrow->insert_sample(keys[i] + 1);
+    narrow->sanity_check();
+    BOOST_CHECK(narrow->total() == total + size);
+    unsigned long long cdf = 0;
+    for (unsigned i = 0; i < size; ++i) {
+        cdf += low[i];
+        BOOST_CHECK(narrow->search_PDF(keys[i]) == low[i]);
+        BOOST_CHECK(narrow->search_CDF(keys[i]) == cdf + i);
+    }
+
+    // overflowing counts throw and leave the tree untouched
+    narrow->insert_sample(-1, std::numeric_limits<unsigned>::max() - 1);
+    BOOST_CHECK_THROW(narrow->insert_sample(-1, 2), std::runtime_error);
+    std::vector<int> batch = {-3, -1};
+    std::vector<unsigned> batch_counts = {1, 2};
+    BOOST_CHECK_THROW(narrow->insert_sorted(batch.data(), batch_counts.data(), batch.size()), std::runtime_error);
+    narrow->sanity_check();
+    BOOST_CHECK(narrow->total() == total + size + std::numeric_limits<unsigned>::max() - 1);
+    BOOST_CHECK(narrow->search_PDF(-3) == 0);
+
+    auto small = RootNodeCluster<int, 4096, unsigned, unsigned>::factory();
+    small->insert_sample(1, std::numeric_limits<unsigned>::max() - 1);
+    BOOST_CHECK_THROW(small->insert_sample(2, 2), std::runtime_error);
+    small->sanity_check();
+    BOOST_CHECK(small->search_PDF(2) == 0);
+    BOOST_CHECK(small->total() == std::numeric_limits<unsigned>::max() - 1);
+
+    CDFTree<int> tree;
+    tree.insert_sample(0, std::numeric_limits<unsigned>::max());
+    BOOST_CHECK_THROW(tree.insert_sample(0), std::runtime_error);
+    std::vector<int> samples = {-1, 0, 1};
+    BOOST_CHECK_THROW(tree.insert_batch(samples), std::runtime_error);
+    BOOST_CHECK(tree.search_CDF(-1) == 0.);
+    BOOST_CHECK(tree.search_PDF(0) == 1.);
+}
+
+template<class Float>
+void check_key_traits() {
+    using Traits = KeyTraits<Float>;
+    using Limits = std::numeric_limits<Float>;
+    std::vector<Float> ordered = {-Limits::infinity(), -Limits::max(), -1, -Limits::min(), -Limits::denorm_min(),
+                                  0, Limits::denorm_min(), Limits::min(), 1, Limits::max(), Limits::infinity()};
+    for (std::size_t i = 0; i < ordered.size(); ++i) {
+        BOOST_CHECK(Traits::decode(Traits::encode(ordered[i])) == ordered[i]);
+        if (i > 0)
+            BOOST_CHECK(Traits::encode(ordered[i-1]) < Traits::encode(ordered[i]));
+    }
+    BOOST_CHECK(Traits::encode(-Float(0)) == Traits::encode(Float(0)));
+    BOOST_CHECK(not std::signbit(Traits::decode(Traits::encode(-Float(0)))));
+    BOOST_CHECK(Traits::encode(Limits::quiet_NaN()) == Traits::encode(-Limits::quiet_NaN()));
+    BOOST_CHECK(Traits::encode(Limits::signaling_NaN()) == Traits::encode(Limits::quiet_NaN()));
+    BOOST_CHECK(Traits::encode(Limits::infinity()) < Traits::encode(Limits::quiet_NaN()));
+    BOOST_CHECK(std::isnan(Traits::decode(Traits::encode(Limits::quiet_NaN()))));
+
+    // NaN is one element above +inf, -0 and +0 are the same element
+    CDFTree<Float> tree;
+    tree.insert_sample(-Float(0));
+    tree.insert_sample(Float(0));
+    tree.insert_sample(Limits::infinity());
+    std::vector<Float> batch = {Limits::quiet_NaN(), -Limits::quiet_NaN(), Float(1), -Float(1)};
+    tree.insert_batch(batch);
+    BOOST_CHECK(tree.search_count(-Float(0)) == 2);
+    BOOST_CHECK(tree.search_count(Limits::quiet_NaN()) == 2);
+    BOOST_CHECK(tree.search_CDF(Limits::infinity()) == 5. / 7);
+    BOOST_CHECK(tree.search_CDF(Limits::quiet_NaN()) == 1.);
+    BOOST_CHECK(tree.minimal_element() == -1);
+    BOOST_CHECK(std::isnan(tree.maximal_element()));
+    BOOST_CHECK(std::isnan(tree.inverse_search_CDF(1.)));
+    BOOST_CHECK(tree.inverse_search_CDF(0.4) == 0);
+
+    FrozenCDFTree<Float> frozen = tree.freeze();
+    BOOST_CHECK(frozen.search_CDF(Limits::infinity()) == 5. / 7);
+    BOOST_CHECK(frozen.search_count(-Float(0)) == 2);
+    BOOST_CHECK(std::isnan(frozen.maximal_element()));
+
+    // wrappers store elements the same way
+    std::vector<Float> samples = {-Float(0), Float(0), Limits::quiet_NaN(), Float(1), -Float(1)};
+    ShardedCDFTree<Float> sharded(2);
+    sharded.insert_batch(samples.data(), samples.size());
+    BOOST_CHECK(sharded.search_count(Float(0)) == 2);
+    BOOST_CHECK(sharded.search_CDF(Float(1)) == 4. / 5);
+    BOOST_CHECK(std::isnan(sharded.maximal_element()));
+    BOOST_CHECK(std::isnan(sharded.inverse_search_CDF(1.)));
+    SnapshotCDFTree<Float> snapshots;
+    snapshots.insert_batch(samples.data(), samples.size());
+    snapshots.insert_sample(Limits::quiet_NaN());
+    BOOST_CHECK(snapshots.snapshot().search_count(-Float(0)) == 2);
+    BOOST_CHECK(snapshots.search_CDF(Float(1)) == 4. / 6);
+    BOOST_CHECK(std::isnan(snapshots.inverse_search_CDF(1.)));
+    DecayedCDFTree<Float> decayed(1.);
+    for (Float e : samples)
+        decayed.insert_sample(e);
+    BOOST_CHECK(std::abs(decayed.search_CDF(Float(1)) - 4. / 5) < 1e-12);
+    BOOST_CHECK(decayed.search_PDF(-Float(0)) == decayed.search_PDF(Float(0)));
+    BOOST_CHECK(std::isnan(decayed.maximal_element()));
+    BOOST_CHECK(decayed.inverse_search_CDF(0.5) == 0);
+
+    std::vector<Float> keys = {-1, 0, Limits::quiet_NaN()};
+    std::vector<unsigned> counts = {1, 1, 1};
+    BOOST_CHECK(CDFTree<Float>::from_sorted(keys.data(), counts.data(), keys.size()).search_CDF(0) == 2. / 3);
+    keys = {-Float(0), Float(0)};
+    BOOST_CHECK_THROW(CDFTree<Float>::from_sorted(keys.data(), counts.data(), keys.size()), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE( key_traits ) {
+    check_key_traits<float>();
+    check_key_traits<double>();
+    BOOST_CHECK(KeyTraits<int>::encode(-5) == -5);
+}
+
+BOOST_AUTO_TEST_CASE( tree_stats ) {
+    CDFTree<int> tree;
+    CDFTreeStats empty = tree.stats();
+    BOOST_CHECK(empty.height == 1);
+    BOOST_CHECK(empty.leaves == 0);
+    BOOST_CHECK(empty.distinct == 0);
+
+    auto root = RootNodeCluster<int>::factory();
+    for (int i = 0; i < 300000; ++i)
+        root->insert_sample(i, 1 + i % 3);
+    CDFTreeStats grown = root->stats();
+    BOOST_CHECK(grown.height >= 3);
+    BOOST_CHECK(grown.nodes_per_level.size() == grown.height);
+    BOOST_CHECK(grown.nodes_per_level.front() == 1);
+    BOOST_CHECK(grown.nodes_per_level.back() == grown.leaves);
+    BOOST_CHECK(grown.internal_nodes + grown.leaves ==
+            std::accumulate(grown.nodes_per_level.begin(), grown.nodes_per_level.end(), std::size_t(0)));
+    BOOST_CHECK(grown.distinct == 300000);
+    BOOST_CHECK(grown.total == root->total());
+    // first leaf is created by the first insert, every other one by a split
+    BOOST_CHECK(grown.leaf_splits == grown.leaves - 1);
+    BOOST_CHECK(grown.internal_splits >= grown.height - 2);
+    BOOST_CHECK(grown.merges == 0);
+    // sequential inserts leave halves of leaves behind
+    BOOST_CHECK(grown.leaf_fill > 0.45 and grown.leaf_fill < 0.55);
+    BOOST_CHECK(grown.internal_fill > 0. and grown.internal_fill <= 1.);
+    BOOST_CHECK(grown.used_bytes == 4096 * (grown.internal_nodes + grown.leaves));
+    BOOST_CHECK(grown.reserved_bytes >= grown.used_bytes);
+    BOOST_CHECK(grown.allocated_bytes > grown.reserved_bytes);
+
+    for (int i = 0; i < 290000; ++i)
+        root->remove_sample(i, 1 + i % 3);
+    CDFTreeStats shrunk = root->stats();
+    BOOST_CHECK(shrunk.distinct == 10000);
+    BOOST_CHECK(shrunk.merges > 0);
+    BOOST_CHECK(shrunk.leaves < grown.leaves);
+    BOOST_CHECK(shrunk.used_bytes == 4096 * (shrunk.internal_nodes + shrunk.leaves));
+}
+
 BOOST_AUTO_TEST_CASE( tree_constructor ) {
     auto root = RootNodeCluster<int>::factory();
 }
@@ -160,6 +1114,26 @@ BOOST_AUTO_TEST_CASE( insert_mixed ) {
     }
 }
 
+BOOST_AUTO_TEST_CASE( cdf_after_root_split ) {
+    constexpr int size = 300000;
+    auto root = RootNodeCluster<int>::factory();
+
+    for (int i = 0; i < size; ++i)
+        root->insert_sample(i, 1 + i % 3);
+    root->sanity_check();
+
+    unsigned long long cdf = 0;
+    for (int i = 0; i < size; ++i) {
+        cdf += 1 + i % 3;
+        if (i % 97 == 0) {
+            BOOST_CHECK(root->search_CDF(i) == cdf);
+            BOOST_CHECK(root->inverse_search_CDF(cdf) == i);
+            BOOST_CHECK(root->inverse_search_CDF(cdf - i % 3) == i);
+        }
+    }
+    BOOST_CHECK_THROW(root->inverse_search_CDF(cdf + 1), std::runtime_error);
+}
+
 //BOOST_AUTO_TEST_CASE(CDF
 BOOST_AUTO_TEST_CASE( lower_or_equal_bound ) {
     int array[6] = {-5,4,20,30,70,130};
@@ -206,6 +1180,103 @@ BOOST_AUTO_TEST_CASE( binary_search ) {
         BOOST_CHECK( ::utils::binary_search(array2, 7, query2[i]) == resul2[i] );
 }
 
+BOOST_AUTO_TEST_CASE( fenwick ) {
+    std::mt19937 rng(42);
+    for (unsigned size = 1; size < 70; ++size) {
+        std::vector<unsigned long long> plain(size), tree;
+        for (auto& x : plain)
+            x = rng() % 10;
+        tree = plain;
+        ::utils::fenwick_build(tree.data(), size);
+
+        for (unsigned update = 0; update < 10; ++update) {
+            unsigned index = rng() % size;
+            plain[index] += 3;
+            ::utils::fenwick_add(tree.data(), size, index, 3ull);
+        }
+
+        unsigned long long prefix = 0;
+        for (unsigned i = 0; i < size; ++i) {
+            BOOST_CHECK(::utils::fenwick_prefix(tree.data(), i) == prefix);
+            BOOST_CHECK(::utils::fenwick_value(tree.data(), i) == plain[i]);
+            prefix += plain[i];
+        }
+        for (unsigned long long value = 1; value <= prefix; ++value) {
+            unsigned long long rest = value;
+            unsigned index = ::utils::fenwick_select(tree.data(), size, rest);
+            unsigned expected = 0;
+            unsigned long long before = 0;
+            while (before + plain[expected] < value)
+                before += plain[expected++];
+            BOOST_CHECK(index == expected);
+            BOOST_CHECK(rest == value - before);
+        }
+
+        ::utils::fenwick_unbuild(tree.data(), size);
+        BOOST_CHECK(tree == plain);
+    }
+}
+
+template<class T, class Generator>
+void check_simd_kernels(Generator generate) {
+    std::mt19937 rng(42);
+    using utils::simd::Isa;
+
+    for (unsigned size = 0; size < 600; size += 7) {
+        std::vector<T> array;
+        for (unsigned i = 0; i < size; ++i)
+            array.push_back(generate(rng));
+        std::sort(array.begin(), array.end());
+        array.erase(std::unique(array.begin(), array.end()), array.end());
+
+        std::vector<T> queries(array);
+        for (unsigned i = 0; i < 20; ++i)
+            queries.push_back(generate(rng));
+
+        for (int isa = 0; isa <= static_cast<int>(utils::simd::cpu_isa); ++isa)
+            for (T q : queries) {
+                unsigned le = std::upper_bound(array.begin(), array.end(), q) - array.begin();
+                unsigned lt = std::lower_bound(array.begin(), array.end(), q) - array.begin();
+                BOOST_CHECK(utils::simd::count_less_equal(array.data(), array.size(), q, Isa(isa)) == le);
+                BOOST_CHECK(utils::simd::count_less(array.data(), array.size(), q, Isa(isa)) == lt);
+            }
+    }
+}
+
+BOOST_AUTO_TEST_CASE( parallel_sort ) {
+    std::mt19937 rng(42);
+    for (unsigned size : {0u, 10u, 100000u, 1000000u}) {
+        std::vector<unsigned> data(size);
+        for (auto& x : data)
+            x = rng();
+        std::vector<unsigned> expected(data);
+        std::sort(expected.begin(), expected.end());
+        ::utils::parallel_sort(data.begin(), data.end(), std::less<>(), 8);
+        BOOST_CHECK(data == expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( parallel_for_exceptions ) {
+    // a failing chunk, whichever thread runs it, reaches the caller after all chunks ran
+    for (std::size_t failing : {0u, 5u, 99u}) {
+        std::atomic<unsigned> done(0);
+        BOOST_CHECK_THROW(::utils::parallel_for(100, [&](std::size_t first, std::size_t last) {
+            ++done;
+            if (first <= failing and failing < last)
+                throw std::runtime_error("chunk failed");
+        }, 8), std::runtime_error);
+        BOOST_CHECK(done == 8);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( simd_search ) {
+    check_simd_kernels<int>([](std::mt19937& r) { return static_cast<int>(r() % 2001) - 1000; });
+    check_simd_kernels<unsigned>([](std::mt19937& r) { return static_cast<unsigned>(r()); });
+    check_simd_kernels<std::uint64_t>([](std::mt19937& r) { return std::uint64_t(r()) << 32 | r(); });
+    check_simd_kernels<float>([](std::mt19937& r) { return std::uniform_real_distribution<float>(-1, 1)(r); });
+    check_simd_kernels<double>([](std::mt19937& r) { return std::uniform_real_distribution<double>(-1, 1)(r); });
+}
+
 /*
 BOOST_AUTO_TEST_CASE( search_in_array ) {
     std::array<int, 13> odd_array ({1,2,3,4,5,6,7,8,9,10,11,12,13});